@@ -13,20 +13,17 @@
 
 #include "oipshared.h"
 #include "toolbox.h"
+#include "rrc.h"
+#include "tiffwriter.h"
+#include "warp.h"
 
 BEGIN_NS(OIP)
 
 const int REMAP_ROW_GUARD = 32767;
 const int REMAP_SECTION_ROWS = 30000;
-
-struct GdalDsDtor {
-    inline void operator()(GDALDataset * ds) { if (ds) GDALClose(ds); }
-};
-
-struct RRCParam {
-    double k;
-    double b;
-};
+const int RRC_STREAM_BLOCKLINES = 1024;
+const int RRC_STREAM_BUFFERS = 4;
+const int RRC_STREAM_TASKLINES = 64;
 
 class ImageOperations;
 typedef class ImageOperations IMO;
@@ -126,15 +123,12 @@ public:
         return content;
     }
     
+    /// results are truncated & saturated to [0, 65535],
+    /// SIMD path is chosen at runtime & row blocks run on the shared thread pool, see `RRCKernel'
     static void InplaceRRC(uint16_t * buff, int w, int h, const RRCParam * rrcParam) {
-        for (size_t y = 0; y < h; ++y) {
-            for (size_t x = 0; x < w; ++x) {
-                size_t idx = w * y + x;
-                uint16_t src = buff[idx];
-                uint16_t dst = (uint16_t)(rrcParam[x].k * src + rrcParam[x].b);
-                buff[idx] = dst;
-            }
-        }
+        RRCKernel kernel(rrcParam, w);
+        RRCJob job = { buff, (size_t)h, &kernel };
+        RRCKernel::ApplyParallel(&job, 1);
     }
     
     static RRCParam * LoadRRCParamFile(const char * paramFilePath, int expectedLines) {
@@ -227,6 +221,126 @@ public:
         return NULL;
     }
     
+    /// streaming version of `DoRRC4RAW()': a reader thread, in-cache RRC of each block (row blocks on
+    /// the shared thread pool) and a writer thread overlap each other, memory is bounded to
+    /// `RRC_STREAM_BUFFERS' blocks of `blockLines' lines.
+    static void StreamRRC4RAW(const std::string & raw,
+                              int pixelPerLine,
+                              const std::string & rrc,
+                              const std::string & saveRaw,
+                              int blockLines = RRC_STREAM_BLOCKLINES) {
+        if (blockLines <= 0) throw std::invalid_argument("StreamRRC4RAW(): block lines should be a positive integer");
+        size_t size = FileSize(raw);
+        size_t lineBytes = (size_t)pixelPerLine * BYTES_PER_PIXEL;
+        size_t lines = size / lineBytes;
+        scoped_ptr<RRCParam> rrcParam = LoadRRCParamFile(rrc.c_str(), pixelPerLine);
+        RRCKernel kernel(rrcParam, pixelPerLine);
+        
+        scoped_ptr<FILE, FileDtor> fi = fopen(raw.c_str(), "rb");
+        if (fi.is_null()) throw errno_error(xs("open raw image file [%s] failed", raw.c_str()).s);
+        scoped_ptr<FILE, FileDtor> fo = fopen(saveRaw.c_str(), "wb");
+        if (fo.is_null()) throw errno_error(xs("open file [%s] for writing failed", saveRaw.c_str()).s);
+        
+        struct Block {
+            uint16_t * data;
+            size_t lines;
+        };
+        std::unique_ptr<uint16_t[]> buffers[RRC_STREAM_BUFFERS];
+        BoundedQueue<Block> freeBlocks(RRC_STREAM_BUFFERS);
+        BoundedQueue<Block> readBlocks(RRC_STREAM_BUFFERS);
+        BoundedQueue<Block> doneBlocks(RRC_STREAM_BUFFERS);
+        for (int i = 0; i < RRC_STREAM_BUFFERS; ++i) {
+            buffers[i].reset(new uint16_t[(size_t)blockLines * pixelPerLine]);
+            freeBlocks.Push({ buffers[i].get(), 0 });
+        }
+        
+        OLOG("Streaming RRC `%s' -> `%s' (%d lines per block) ...", raw.c_str(), saveRaw.c_str(), blockLines);
+        std::exception_ptr readError;
+        std::exception_ptr writeError;
+        RRCVerifyStats verified;
+        double readTime = 0.0, rrcTime = 0.0, writeTime = 0.0;
+        stop_watch sw;
+        
+        std::thread reader([&]() {
+            try {
+                Block blk;
+                for (size_t done = 0; done < lines && freeBlocks.Pop(blk); done += blk.lines) {
+                    blk.lines = std::min((size_t)blockLines, lines - done);
+                    stop_watch rsw;
+                    if (fread(blk.data, lineBytes, blk.lines, fi) != blk.lines) {
+                        throw errno_error(xs("read raw image file failed at line %s", comma_sep(done).sep()).s);
+                    }
+                    readTime += rsw.tick().ellapsed;
+                    if (!readBlocks.Push(blk)) break;
+                }
+            } catch (...) {
+                readError = std::current_exception();
+            }
+            readBlocks.Close();
+        });
+        std::thread writer([&]() {
+            try {
+                Block blk;
+                while (doneBlocks.Pop(blk)) {
+                    stop_watch wsw;
+                    if (fwrite(blk.data, lineBytes, blk.lines, fo) != blk.lines) {
+                        throw errno_error("write RRC result file failed");
+                    }
+                    writeTime += wsw.tick().ellapsed;
+                    freeBlocks.Push(blk);
+                }
+            } catch (...) {
+                writeError = std::current_exception();
+                doneBlocks.Close();
+            }
+            freeBlocks.Close();
+        });
+        
+        try {
+            Block blk;
+            while (readBlocks.Pop(blk)) {
+                stop_watch csw;
+                RRCJob job = { blk.data, blk.lines, &kernel };
+                RRCKernel::ApplyParallel(&job, 1, RRC_STREAM_TASKLINES, false, &verified);
+                rrcTime += csw.tick().ellapsed;
+                if (!doneBlocks.Push(blk)) break;
+            }
+        } catch (...) {
+            // i.e. failed RRC verification: stop both threads before unwinding
+            freeBlocks.Close();
+            readBlocks.Close();
+            doneBlocks.Close();
+            writer.join();
+            reader.join();
+            throw;
+        }
+        doneBlocks.Close();
+        writer.join();
+        readBlocks.Close();
+        reader.join();
+        if (readError) std::rethrow_exception(readError);
+        if (writeError) std::rethrow_exception(writeError);
+        
+        // trailing bytes of an incomplete line are copied as is
+        size_t tail = size - lines * lineBytes;
+        if (tail > 0) {
+            char * p = (char *)buffers[0].get();
+            if (fread(p, 1, tail, fi) != tail || fwrite(p, 1, tail, fo) != tail) {
+                throw errno_error("copy trailing bytes of raw image file failed");
+            }
+        }
+        
+        auto es = sw.tick().ellapsed;
+        OLOG("%s bytes streamed in %s seconds (%s MBps), busy time: read %s, RRC %s, write %s seconds.",
+             comma_sep(size).sep(),
+             comma_sep(es).sep(),
+             comma_sep(size/es/(1024.0*1024.0)).sep(),
+             comma_sep(readTime).sep(),
+             comma_sep(rrcTime).sep(),
+             comma_sep(writeTime).sep());
+        verified.Log(kernel.Options());
+    }
+    
     static int SectionaryRemap(int total_rows, int upper_cut, int bottom_cut,
                                std::function<cv::Mat(int row_offset, int rows)>get_src,
                                std::function<cv::Mat(int row_offset, int rows)>get_mapx,
@@ -234,7 +348,7 @@ public:
                                std::function<void(const cv::Mat &data, int row_offset)>write_upper,
                                std::function<void(const cv::Mat &data, int row_offset)>write_dst,
                                std::function<void(const cv::Mat &data, int row_offset)>write_bottom,
-                               int interpolation = cv::INTER_CUBIC,
+                               int interpolation = WarpOptions::CvInterpolation(WarpOptions::Global().quality),
                                int border_mode = cv::BORDER_CONSTANT,
                                const cv::Scalar & border_value = cv::Scalar()) {
         
@@ -313,7 +427,24 @@ public:
         scoped_ptr<FILE, FileDtor> fo;
         scoped_ptr<GDALDataset, GdalDsDtor> ds;
         GDALRasterBand * bnd = NULL;
-        if (outputIsTiff) {
+        std::unique_ptr<TiffWriter> cogWriter;
+        cv::Mat strip;
+        int stripRow = 0;
+        if (outputIsTiff && TiffOptions::Global().cog) {
+            // lines are gathered into strips for the COG writer, which builds overviews as strips are written
+            cogWriter.reset(new TiffWriter(outputFilePath, outputFullLinePixels, imageLines, 1));
+            writer = [&](void * buff, int bytes, int row, int col) {
+                if (strip.empty()) {
+                    stripRow = row;
+                    strip.create(std::min(TIFF_WRITE_STRIP_ROWS, imageLines - row), outputFullLinePixels, CV_16UC1);
+                }
+                memcpy(strip.ptr<uint16_t>(row - stripRow) + col, buff, bytes);
+                if (col > 0 && row - stripRow + 1 == strip.rows) {
+                    cogWriter->Write(strip, stripRow);
+                    strip.release(); // queued strip is kept by the writer, next lines go to a new one
+                }
+            };
+        } else if (outputIsTiff) {
             GDALDriver * drv = GetGDALDriverManager()->GetDriverByName("GTiff");
             ds = drv->Create(outputFilePath.c_str(), outputFullLinePixels, imageLines, 1, GDT_UInt16, NULL);
             bnd = ds->GetRasterBand(1);
@@ -353,6 +484,7 @@ public:
                 OLOG("%s lines of image data stitched.", comma_sep(i+1).sep());
             }
         }
+        if (cogWriter) cogWriter->Close();
         auto es = stop_watch::tik().ellapsed;
         OLOG("%s bytes written in %s seconds (%s MBps).",
              comma_sep(szl).sep(),
@@ -415,7 +547,7 @@ public:
         
         int outputHalfLinePixels = imageL.cols - foldColPixels;
         int outputFullLinePixels = outputHalfLinePixels * 2;
-        if (szl < 4000000000 && !useGDAL) { // around 4GB
+        if (szl < 4000000000 && !useGDAL && !TiffOptions::Global().cog) { // around 4GB
             cv::Mat stitchedImage(imageL.rows, outputFullLinePixels, CV_16UC4);
             cv::Mat stitchLeft = imageL.colRange(0, outputHalfLinePixels);
             cv::Mat stitchRiht = imageR.colRange(foldColPixels, imageR.cols);
@@ -456,6 +588,77 @@ public:
         return outputFilePath;
     }
     
+    /// aligned MSS TIFF as `PreProcessor' writes it (`TiffOptions::rgba', global layout) read back with
+    /// `cv::imread' like `StitchTiff()' does, then stitched: channels should come back as written, in order,
+    /// from the stitched TIFF or, with `--cog', from the bands of the stitched COG.
+    /// throws on mismatch, temporary files are removed
+    static void SelfTestStitchRoundTrip(int rows = 300, int cols = 257) {
+        auto dir = std::filesystem::temp_directory_path();
+        const std::string paths[] = {
+            (dir / "oip_selftest_left" TIFF_FILE_EXT).string(),
+            (dir / "oip_selftest_right" TIFF_FILE_EXT).string(),
+            (dir / "oip_selftest_stitched" TIFF_FILE_EXT).string(),
+        };
+        struct Cleanup {
+            const std::string * paths;
+            ~Cleanup() { for (int i = 0; i < 3; ++i) VSIUnlink(paths[i].c_str()); }
+        } cleanup = { paths };
+
+        TiffOptions options = TiffOptions::Global();
+        options.rgba = true;
+        cv::Mat images[2];
+        uint32_t seed = 0x6A09E667;
+        for (int i = 0; i < 2; ++i) {
+            images[i].create(rows, cols, CV_16UC4);
+            for (int y = 0; y < rows; ++y) {
+                uint16_t * p = images[i].ptr<uint16_t>(y);
+                for (int x = 0; x < cols * 4; ++x) {
+                    seed = seed * 1664525 + 1013904223;
+                    p[x] = (uint16_t)((x % 4 + 1) * 10000 + (seed >> 22)); // channels tell apart by magnitude
+                }
+            }
+            TiffWriter writer(paths[i], cols, rows, 4, options);
+            writer.Write(images[i].rowRange(0, rows / 2), 0);
+            writer.Write(images[i].rowRange(rows / 2, rows), rows / 2);
+            writer.Close();
+
+            cv::Mat read = cv::imread(paths[i], cv::IMREAD_UNCHANGED);
+            if (read.type() != CV_16UC4 || read.rows != rows || read.cols != cols || cv::norm(read, images[i], cv::NORM_INF) != 0) {
+                throw std::runtime_error(xs("aligned TIFF round trip: `cv::imread' of [%s] does not give the written channels back",
+                                            paths[i].c_str()).s);
+            }
+        }
+
+        StitchTiff(paths[0], paths[1], paths[2], 0);
+        cv::Mat stitched;
+        if (TiffOptions::Global().cog) {
+            // COG output is laid out like `StitchTiffGDAL()' writes: channel c in band c + 1, PHOTOMETRIC=RGB
+            scoped_ptr<GDALDataset, GdalDsDtor> ds = (GDALDataset *)GDALOpen(paths[2].c_str(), GA_ReadOnly);
+            if (ds.is_null() || ds->GetRasterXSize() != cols * 2 || ds->GetRasterYSize() != rows || ds->GetRasterCount() != 4) {
+                throw std::runtime_error("aligned TIFF round trip: stitched COG is missing or of a different size");
+            }
+            int overviews = OverviewPyramid::LevelsFor(cols * 2, rows, TiffOptions::Global().TileSizeForCog());
+            if (ds->GetRasterBand(1)->GetColorInterpretation() != GCI_RedBand
+                || ds->GetRasterBand(3)->GetColorInterpretation() != GCI_BlueBand
+                || ds->GetRasterBand(1)->GetOverviewCount() != overviews) {
+                throw std::runtime_error("aligned TIFF round trip: stitched COG is not RGB or lacks its overviews");
+            }
+            stitched.create(rows, cols * 2, CV_16UC4);
+            if (ds->RasterIO(GF_Read, 0, 0, cols * 2, rows, stitched.data, cols * 2, rows, GDT_UInt16, 4, NULL,
+                             stitched.elemSize(), stitched.step[0], stitched.elemSize1()) == CE_Failure) {
+                throw std::runtime_error(xs("aligned TIFF round trip: read stitched COG failed: %s", CPLGetLastErrorMsg()).s);
+            }
+        } else {
+            stitched = cv::imread(paths[2], cv::IMREAD_UNCHANGED);
+        }
+        if (stitched.type() != CV_16UC4 || stitched.rows != rows || stitched.cols != cols * 2
+            || cv::norm(stitched.colRange(0, cols), images[0], cv::NORM_INF) != 0
+            || cv::norm(stitched.colRange(cols, cols * 2), images[1], cv::NORM_INF) != 0) {
+            throw std::runtime_error("aligned TIFF round trip: stitched image does not hold the written channels");
+        }
+        OLOG("Aligned TIFF round trip: channels read back & stitched as written.");
+    }
+    
 private:
     static void StitchTiffGDAL(cv::Mat & imageL,
                                cv::Mat & imageR,
@@ -463,6 +666,11 @@ private:
                                int foldColPixels,
                                int * bandMap = NULL,
                                bool setBandInterpretion = false) {
+        if (TiffOptions::Global().cog) {
+            StitchTiffCOG(imageL, imageR, outputImagePath, foldColPixels, bandMap);
+            return;
+        }
+        
         int imageLines = imageL.rows;
         int outputHalfLinePixels = imageL.cols - foldColPixels;
         int outputFullLinePixels = outputHalfLinePixels * 2;
@@ -472,87 +680,70 @@ private:
         options = CSLSetNameValue(options, "PREDICTOR", "2");
         options = CSLSetNameValue(options, "NUM_THREADS", "ALL_CPUS");
         options = CSLSetNameValue(options, "PHOTOMETRIC", "RGB");
+        options = CSLSetNameValue(options, "INTERLEAVE", TiffOptions::Global().interleave.c_str());
         GDALDriver * drv = GetGDALDriverManager()->GetDriverByName("GTiff");
         scoped_ptr<GDALDataset, GdalDsDtor> ds = drv->Create(outputImagePath.c_str(),
                                                              outputFullLinePixels,
                                                              imageLines,
                                                              MSS_BANDS, GDT_UInt16, options);
         CSLDestroy(options);
+        if (ds.is_null()) {
+            throw std::runtime_error(xs("create TIFF file [%s] failed: %s", outputImagePath.c_str(), CPLGetLastErrorMsg()).s);
+        }
+        
+        GDALColorInterp bandIntp[MSS_BANDS] = {
+            GCI_RedBand,
+            GCI_GreenBand,
+            GCI_BlueBand,
+            GCI_AlphaBand,
+        };
+        if (setBandInterpretion) {
+            for (int b = 0; b < MSS_BANDS; ++b) ds->GetRasterBand(1+b)->SetColorInterpretation(bandIntp[b]);
+        }
+        
+        // output band b is input channel bandMap[b]-1: a permutation is written by a single interleaved RasterIO
+        // per half with GDAL's band list (input channel -> output band), duplicated channels band by band
+        int datasetBands[MSS_BANDS];
+        bool permutation = true;
+        for (int b = 0; b < MSS_BANDS; ++b) datasetBands[b] = 0;
+        for (int b = 0; b < MSS_BANDS; ++b) {
+            int channel = bandMap ? bandMap[b] - 1 : b;
+            permutation = permutation && datasetBands[channel] == 0;
+            datasetBands[channel] = 1 + b;
+        }
+        
+        // halves are written straight from the input images: pixel spacing over the channels, line spacing
+        // of the image step, no section copy, split or clone
+        auto writeHalf = [&](const cv::Mat & image, int srcCol, int dstCol, int row, int lines) {
+            const char * p = (const char *)image.ptr(row) + (size_t)srcCol * image.elemSize();
+            CPLErr err = CE_None;
+            if (permutation) {
+                err = ds->RasterIO(GF_Write,
+                                   dstCol, row, outputHalfLinePixels, lines,
+                                   (void *)p, outputHalfLinePixels, lines, GDT_UInt16,
+                                   MSS_BANDS, datasetBands,
+                                   image.elemSize(), image.step[0], image.elemSize1());
+            }
+            for (int b = 0; !permutation && b < MSS_BANDS && err != CE_Failure; ++b) {
+                err = ds->GetRasterBand(1+b)->RasterIO(GF_Write,
+                                                       dstCol, row, outputHalfLinePixels, lines,
+                                                       (void *)(p + (bandMap[b] - 1) * image.elemSize1()),
+                                                       outputHalfLinePixels, lines, GDT_UInt16,
+                                                       image.elemSize(), image.step[0]);
+            }
+            if (err == CE_Failure) {
+                throw errno_error(xs("write stitched image file failed at line %d: %s", row, CPLGetLastErrorMsg()).s);
+            }
+        };
         
         int sections = (imageLines - 1) / IBPA_DEFAULT_BATCHLINES + 1;
         int processedLines = 0;
-        cv::Mat imageFullSection(IBPA_DEFAULT_BATCHLINES, outputFullLinePixels, CV_16UC4);
-        cv::Mat splitBands[MSS_BANDS];
-        cv::Mat splitConts[MSS_BANDS];
-
         stop_watch::rst();
         for (int s = 0; s < sections; ++s) {
             int sectionLines = std::min(imageLines - processedLines, IBPA_DEFAULT_BATCHLINES);
-            
-            cv::Range rowRng(processedLines, processedLines + sectionLines);
-            cv::Range colRngL(0, outputHalfLinePixels);
-            cv::Range colRngR(foldColPixels, imageR.cols);
-            
-            cv::Range rowRngT(0, sectionLines);
-            cv::Range colRngTL = colRngL;
-            cv::Range colRngTR(outputHalfLinePixels, outputFullLinePixels);
-            
-            OLOG("Merging 2 CMOS image data part %d/%d ...", s+1, sections);
-            auto sectionL = imageL(rowRng, colRngL);
-            auto sectionR = imageR(rowRng, colRngR);
-            auto destL = imageFullSection(rowRngT, colRngTL);
-            auto destR = imageFullSection(rowRngT, colRngTR);
-            sectionL.copyTo(destL);
-            sectionR.copyTo(destR);
-            
-            GDALColorInterp bandIntp[MSS_BANDS] = {
-                GCI_RedBand,
-                GCI_GreenBand,
-                GCI_BlueBand,
-                GCI_AlphaBand,
-            };
-            
-            OLOG("Writing to TIFF image file ...");
-            
-            cv::split(imageFullSection, splitBands);
-            for (int b = 0; b < MSS_BANDS; ++b) {
-                if (splitBands[b].isContinuous()) {
-                    splitConts[b] = splitBands[b];
-                } else {
-                    splitConts[b] = splitBands[b].clone();
-                    OLOG("Cloned band #%d of section #%d.", b+1, s);
-                }
-            }
-            for (int b = 0; b < MSS_BANDS; ++b) {
-                GDALRasterBand * bnd = ds->GetRasterBand(1+b);
-                if (setBandInterpretion) bnd->SetColorInterpretation(bandIntp[b]);
-                int mappedBand = bandMap ? bandMap[b] - 1 : b;
-                if (bnd->RasterIO(GF_Write,
-                                  0, processedLines, outputFullLinePixels, sectionLines,
-                                  (void *)splitConts[mappedBand].data,
-                                  outputFullLinePixels, sectionLines,
-                                  GDT_UInt16, 0, 0) == CE_Failure) {
-                    throw errno_error(xs("write stitched image file failed at line %d of band #%d",
-                                         processedLines, b).s);
-                }
-            }
-
-            /*//
-            for (int b = 0; b < MSS_BANDS; ++b) {
-                GDALRasterBand * bnd = ds->GetRasterBand(1+b);
-                if (setBandInterpretion) bnd->SetColorInterpretation(bandIntp[b]);
-                if (bnd->RasterIO(GF_Write,
-                                  0, processedLines, outputFullLinePixels, sectionLines,
-                                  (void *)((char *)imageFullSection.data + b * BYTES_PER_PIXEL),
-                                  outputFullLinePixels, sectionLines,
-                                  GDT_UInt16,
-                                  BYTES_PER_PIXEL * MSS_BANDS,
-                                  outputFullLinePixels * BYTES_PER_PIXEL * MSS_BANDS) == CE_Failure) {
-                    throw errno_error(xs("write stitched image file failed at line %d of band #%d",
-                                         processedLines, b).s);
-                }
-            }//*/
-            
+            OLOG("Writing 2 CMOS image data part %d/%d to TIFF image file ...", s+1, sections);
+            writeHalf(imageL, 0, 0, processedLines, sectionLines);
+            writeHalf(imageR, foldColPixels, outputHalfLinePixels, processedLines, sectionLines);
             processedLines += sectionLines;
             OLOG("%s lines of image data stitched.", comma_sep(processedLines).sep());
         }
@@ -565,6 +756,50 @@ private:
              comma_sep(es).sep(),
              comma_sep(totalBytes/es/1024.0/1024.0).sep());
     }
+    
+    /// `StitchTiffGDAL()' as COG: sections of both halves (bands reordered by `bandMap' while copying) go to
+    /// a `TiffWriter' (PHOTOMETRIC=RGB as well), which builds the overviews as the sections are written
+    static void StitchTiffCOG(const cv::Mat & imageL,
+                              const cv::Mat & imageR,
+                              const std::string & outputImagePath,
+                              int foldColPixels,
+                              int * bandMap = NULL) {
+        int imageLines = imageL.rows;
+        int outputHalfLinePixels = imageL.cols - foldColPixels;
+        int outputFullLinePixels = outputHalfLinePixels * 2;
+        int bands = imageL.channels();
+        std::vector<int> fromTo;
+        for (int b = 0; b < bands; ++b) {
+            fromTo.push_back(bandMap ? bandMap[b] - 1 : b);
+            fromTo.push_back(b);
+        }
+        
+        TiffOptions options = TiffOptions::Global();
+        options.rgb = bands >= 3; // as `StitchTiffGDAL()' writes
+        TiffWriter writer(outputImagePath, outputFullLinePixels, imageLines, bands, options);
+        stop_watch::rst();
+        for (int row = 0; row < imageLines; row += IBPA_DEFAULT_BATCHLINES) {
+            int sectionLines = std::min(imageLines - row, IBPA_DEFAULT_BATCHLINES);
+            cv::Mat section(sectionLines, outputFullLinePixels, CV_16UC(bands));
+            cv::Mat sectionL = imageL(cv::Range(row, row + sectionLines), cv::Range(0, outputHalfLinePixels));
+            cv::Mat sectionR = imageR(cv::Range(row, row + sectionLines), cv::Range(foldColPixels, imageR.cols));
+            cv::Mat destL = section.colRange(0, outputHalfLinePixels);
+            cv::Mat destR = section.colRange(outputHalfLinePixels, outputFullLinePixels);
+            cv::mixChannels(&sectionL, 1, &destL, 1, fromTo.data(), bands);
+            cv::mixChannels(&sectionR, 1, &destR, 1, fromTo.data(), bands);
+            writer.Write(section, row);
+            OLOG("%s lines of image data stitched.", comma_sep(row + sectionLines).sep());
+        }
+        writer.Close();
+        
+        size_t totalBytes = (size_t)imageLines * outputFullLinePixels * bands * BYTES_PER_PIXEL;
+        auto es = stop_watch::tik().ellapsed;
+        OLOG("Merged COG file '%s' generated.", outputImagePath.c_str());
+        OLOG("%s bytes processed in %s seconds (%s MBps).",
+             comma_sep(totalBytes).sep(),
+             comma_sep(es).sep(),
+             comma_sep(totalBytes/es/1024.0/1024.0).sep());
+    }
 };
 
 END_NS
@@ -33,6 +33,8 @@ struct InputParameters {
     double IBCOR_Threshold;
     int IBCOR_Slices;
     int IBCOR_Sections;
+    IBCMode IBCOR_Mode;
+    int IBCOR_MinValid;
     int IBPA_LineOffset;
     int IBPA_BatchLines;
     int IBPA_OverlapLines;
@@ -45,6 +47,8 @@ struct InputParameters {
     InputParameters() :
         IBCOR_Slices(IBCV_DEF_SLICES),
         IBCOR_Sections(IBCV_DEF_SECTIONS),
+        IBCOR_Mode(IBC_MODE_PAN),
+        IBCOR_MinValid(0),
         IBPA_LineOffset(IBPA_DEFAULT_LINEOFFSET),
         IBPA_BatchLines(IBPA_DEFAULT_BATCHLINES),
         IBPA_OverlapLines(IBPA_DEFAULT_LINEOVERLAP),
@@ -65,10 +69,14 @@ struct StitchParams {
     int sectionLines;
     int overlapCols;
     int edgeCols;
+    int rrcBlockLines;
     double stThreshold;
     double maxDeltaY;
+    double adaptiveTolerance;
+    double timeBudget;
     
     bool doRRC;
+    bool streamRRC;
     bool onlyParamCalc;
     
     StitchParams() :
@@ -76,9 +84,13 @@ struct StitchParams {
         sectionLines(STT_DEF_SECLINES),
         overlapCols(STT_DEF_OVERLAPPX),
         edgeCols(STT_DEF_EDGECOLS),
+        rrcBlockLines(RRC_STREAM_BLOCKLINES),
         stThreshold(STT_DEF_PHCTHRHLD),
         maxDeltaY(STT_DEF_MAXDELTAY),
+        adaptiveTolerance(0.0),
+        timeBudget(0.0),
         doRRC(true),
+        streamRRC(true),
         onlyParamCalc(false)
     {}
 };
@@ -88,11 +100,141 @@ StitchParams stp_;
 
 void PreStitch();
 void DefaultAction();
+void InterBandCorrelationOnly(const std::string & coeffFilePath);
 
 int ParseInputParametersFromCommandLineArguments(int argc, const char * argv[]) {
     CLI::App app("Optical Satellite Image Pre-Processing/Processing Utility", "OpticalImageProcessor");
     app.set_version_flag("-v,--version", "1.1");
     app.require_subcommand(0, 1);
+    app.add_option_function<std::string>("--simd", [](const std::string & v) {
+        SimdLevel level = SIMD_AVX512;
+        if (!Simd::Parse(v, level)) {
+            throw CLI::ValidationError("--simd", "should be one of auto, scalar, sse4.1, avx2, avx512");
+        }
+        Simd::SetMaxLevel(level);
+    }, "Highest SIMD instruction set used by optimized kernels (auto, scalar, sse4.1, avx2, avx512)")->default_str("auto");
+    app.add_option_function<int>("-j,--threads", [](const int & n) {
+        ThreadPool::SetThreads(n);
+    }, "Worker thread count for parallel processing stages, 0 for all hardware threads")->default_str("0")->check(CLI::NonNegativeNumber);
+    app.add_option_function<std::string>("--rrc-engine", [](const std::string & v) {
+        if (!RRCOptions::ParseEngine(v, RRCOptions::Global().engine)) {
+            throw CLI::ValidationError("--rrc-engine", "should be one of double, fixed, lut");
+        }
+    }, "RRC arithmetic: double (reference), fixed (fixed-point coefficients) or lut (per-column lookup tables)")->default_str("double");
+    app.add_option("--rrc-bits", RRCOptions::Global().bits,
+                   "Effective sensor bit depth for fixed/lut RRC engines, input above it is saturated (lut: <= 12)")
+    ->default_str("16")->check(CLI::Range(1, 16));
+    app.add_flag("--rrc-verify", RRCOptions::Global().verify,
+                 "Verify fixed/lut RRC output against double precision RRC, fail if deviation exceeds tolerance");
+    app.add_option("--rrc-tolerance", RRCOptions::Global().tolerance,
+                   "Max deviation (DN) allowed by --rrc-verify")->default_str("1")->check(CLI::NonNegativeNumber);
+    app.add_option("--pyr-levels", RegistrationOptions::Global().levels,
+                   "Pyramid levels for coarse-to-fine shift estimation (inter-band & stitching correlation), "
+                   "0 correlates full windows")->default_str("0")->check(CLI::Range(0, PYR_MAX_LEVELS));
+    app.add_option("--pyr-window-rows", RegistrationOptions::Global().refineRows,
+                   "Rows of full resolution refine window for pyramid registration")
+    ->default_str(std::to_string(PYR_DEF_REFINE_ROWS))->check(CLI::PositiveNumber);
+    app.add_option("--pyr-window-cols", RegistrationOptions::Global().refineCols,
+                   "Cols of full resolution refine window for pyramid registration")
+    ->default_str(std::to_string(PYR_DEF_REFINE_COLS))->check(CLI::PositiveNumber);
+    app.add_flag("--fft-smooth,!--no-fft-smooth", RegistrationOptions::Global().smoothWindows,
+                 "Crop correlation windows to 2/3/5-smooth sizes for faster DFT (default), or keep requested sizes");
+    app.add_option_function<std::string>("--warp-engine", [](const std::string & v) {
+        if (!WarpOptions::ParseEngine(v, WarpOptions::Global().engine)) {
+            throw CLI::ValidationError("--warp-engine", "should be one of analytic, remap");
+        }
+    }, "Inter-band alignment warp: analytic (per-column tables, SIMD bicubic) or remap (float maps, cv::remap)"
+    )->default_str("analytic");
+    app.add_option_function<std::string>("--prestitch-engine", [](const std::string & v) {
+        if (!WarpOptions::ParseEngine(v, WarpOptions::Global().stitchEngine)) {
+            throw CLI::ValidationError("--prestitch-engine", "should be one of analytic, remap");
+        }
+    }, "PAN2 pre-stitch shift: analytic (streamed SIMD bicubic, no section seams) or remap (sectionary cv::remap)"
+    )->default_str("remap");
+    app.add_option_function<std::string>("--quality", [](const std::string & v) {
+        if (!WarpOptions::ParseQuality(v, WarpOptions::Global().quality)) {
+            throw CLI::ValidationError("--quality", "should be one of nearest, bilinear, cubic, lanczos");
+        }
+    }, "Interpolation of inter-band alignment, PAN2 pre-stitch & MSS upscaling for correlation: "
+       "nearest, bilinear, cubic or lanczos (see `warpbench')")->default_str("cubic");
+    app.add_option_function<std::string>("--tiff-compress", [](const std::string & v) {
+        if (!TiffOptions::ParseCompress(v, TiffOptions::Global().compress)) {
+            throw CLI::ValidationError("--tiff-compress", "should be one of none, lzw, deflate, zstd");
+        }
+    }, "Compression of aligned MSS, RRC-ed PAN & COG output: none, lzw, deflate or zstd")->default_str("lzw");
+    app.add_option("--tiff-predictor", TiffOptions::Global().predictor,
+                   "TIFF predictor for compressed output, 1 (none) or 2 (horizontal differencing)")
+    ->default_str("2")->check(CLI::Range(1, 2));
+    app.add_option("--tiff-level", TiffOptions::Global().level,
+                   "DEFLATE (1-12) / ZSTD (1-22) compression level, 0 for GDAL default")
+    ->default_str("0")->check(CLI::Range(0, 22));
+    app.add_option("--tiff-tile", TiffOptions::Global().tileSize,
+                   "Tile size (px, multiple of 16) of TIFF output, 0 writes strips")
+    ->default_str(std::to_string(TIFF_DEF_TILE_SIZE))->check([](const std::string & v) {
+        int n = atoi(v.c_str());
+        return n == 0 || (n >= 16 && n % 16 == 0) ? std::string() : std::string("should be 0 or a multiple of 16");
+    });
+    app.add_option("--tiff-threads", TiffOptions::Global().threads,
+                   "TIFF compression threads, 0 for --threads")->default_str("0")->check(CLI::NonNegativeNumber);
+    app.add_option_function<std::string>("--tiff-interleave", [](const std::string & v) {
+        if (!TiffOptions::ParseInterleave(v, TiffOptions::Global().interleave)) {
+            throw CLI::ValidationError("--tiff-interleave", "should be one of pixel, band");
+        }
+    }, "Multi-band TIFF layout: pixel (interleaved) or band (band sequential), COG is always pixel")->default_str("pixel");
+    app.add_flag("--cog", TiffOptions::Global().cog,
+                 "Write aligned MSS, RRC-ed PAN & stitched TIFF images as cloud optimized GeoTIFF with overviews, "
+                 "built while the images are written");
+    app.add_option("--param-cache", ParamCacheOptions::Global().dir,
+                   "Directory caching inter-band & stitching parameters by input fingerprint, \"\" disables caching")
+    ->default_str(PCACHE_DEF_DIR);
+    app.add_flag("--recompute", ParamCacheOptions::Global().refresh,
+                 "Ignore cached inter-band & stitching parameters, recompute and overwrite them");
+    app.add_option("--import-params", ParamCacheOptions::Global().importFile,
+                   "Use parameters from a cached parameter file (i.e. of another scene) instead of computing them")
+    ->check(CLI::ExistingFile);
+
+    // `selftest` sub command
+    CLI::App & tsa = * app.add_subcommand("selftest",
+                                          "Verify optimized kernels against their reference implementations");
+    tsa.callback([]() {
+        OLOG("Running self tests (SIMD: %s detected, %s in use) ...",
+             Simd::Name(Simd::Detected()), Simd::Name(Simd::Level()));
+        RRCKernel::SelfTest();
+        PixelOps::SelfTest();
+        ColumnShiftWarp::SelfTest();
+        ColumnShiftRemap::SelfTest();
+        IMO::SelfTestStitchRoundTrip();
+        PhaseCorrelator::SelfTest();
+        PyramidRegistrar::SelfTest();
+        OLOG("All self tests passed.");
+    });
+    
+    // `fftbench` sub command
+    int benchRows = CORRELATION_LINES;
+    int benchCols = PIXELS_PER_LINE / IBCV_DEF_SLICES;
+    int benchRepeat = 3;
+    CLI::App & fba = * app.add_subcommand("fftbench",
+                                          "Benchmark DFT & phase correlation time against correlation window width");
+    fba.add_option("-r,--rows", benchRows, "Window rows")->default_val(CORRELATION_LINES)->check(CLI::PositiveNumber);
+    fba.add_option("-c,--cols", benchCols, "Window cols, widths within +/-32 of it are measured")
+    ->default_val(PIXELS_PER_LINE / IBCV_DEF_SLICES)->check(CLI::PositiveNumber);
+    fba.add_option("-n,--repeat", benchRepeat, "Runs per width, best is reported")->default_val(3)->check(CLI::PositiveNumber);
+    fba.callback([&]() {
+        PhaseCorrelator::Benchmark(benchRows, benchCols, benchRepeat);
+    });
+    
+    // `warpbench` sub command
+    int warpRows = 4096;
+    int warpCols = PIXELS_PER_MSSBAND;
+    int warpRepeat = 3;
+    CLI::App & wba = * app.add_subcommand("warpbench",
+                                          "Benchmark warp throughput of every --quality tier, analytic & remap engines");
+    wba.add_option("-r,--rows", warpRows, "Band rows")->default_val(4096)->check(CLI::PositiveNumber);
+    wba.add_option("-c,--cols", warpCols, "Band cols")->default_val(PIXELS_PER_MSSBAND)->check(CLI::PositiveNumber);
+    wba.add_option("-n,--repeat", warpRepeat, "Runs per tier, best is reported")->default_val(3)->check(CLI::PositiveNumber);
+    wba.callback([&]() {
+        ColumnShiftRemap::Benchmark(warpRows, warpCols, warpRepeat);
+    });
     
     // `auxsep` sub command arguments
     std::string aosFilePath;
@@ -140,8 +282,21 @@ int ParseInputParametersFromCommandLineArguments(int argc, const char * argv[])
         return "";
     });
     
+    psa.add_option("--stt-tolerance", stp_.adaptiveTolerance,
+                   "Adaptive stitching parameter calculation: process sections middle-out and stop once the "
+                   "95% confidence half-width of median dx & dy is within this many pixels, 0 processes all sections"
+                   )->default_val(0.0)->check(CLI::NonNegativeNumber);
+    psa.add_option("--stt-time-budget", stp_.timeBudget,
+                   "Stop stitching parameter calculation after this many seconds (adaptive mode), 0 for no limit"
+                   )->default_val(0.0)->check(CLI::NonNegativeNumber);
+    
     psa.add_flag  ("-r,--rrc,!--no-rrc",stp_.doRRC,
                    "Whether do Relative Radiometric Correction or not for PAN after pre-stitch parameter calclationg");
+    psa.add_flag  ("--stream-rrc,!--no-stream-rrc", stp_.streamRRC,
+                   "Stream RRC block by block with overlapped read/RRC/write (default), "
+                   "or load whole PAN files into memory before RRC");
+    psa.add_option("--rrc-block-lines", stp_.rrcBlockLines,
+                   "Lines per block for streaming RRC")->default_val(RRC_STREAM_BLOCKLINES)->check(CLI::PositiveNumber);
     psa.add_flag  ("-c,--only-calculate", stp_.onlyParamCalc,
                    "Only do pre-stitch parameter calculation, do not output pixel-adjusted PAN file.");
     
@@ -189,6 +344,18 @@ int ParseInputParametersFromCommandLineArguments(int argc, const char * argv[])
         Stitcher::Stitch(image1, image2, outputFile, foldCols / 2, useGDAL, bandMap.length() > 0 ? map : NULL);
     });
     
+    // `ibcorr` sub command, takes the default command arguments of PAN/MSS/RRC & inter-band correlation
+    std::string coeffFilePath;
+    CLI::App & ica = * app.add_subcommand("ibcorr",
+                                          "Calculate inter-band correlation coefficients only, "
+                                          "reading just the correlated rows of PAN & MSS");
+    ica.fallthrough();
+    ica.add_option("-o,--output", coeffFilePath,
+                   "Coefficients text file path, `<MSS stem>" IBCOEF_STEM_EXT ".txt' in current directory by default");
+    ica.callback([&]() {
+        InterBandCorrelationOnly(coeffFilePath);
+    });
+    
     // default command arguments
     app.add_option("--pan", ips_.RawFilePAN, "PAN raw image file path")->check(CLI::ExistingFile);
     auto rrc4pan =
@@ -228,6 +395,23 @@ int ParseInputParametersFromCommandLineArguments(int argc, const char * argv[])
     app.add_option("--ibc-sections",
                    ips_.IBCOR_Sections,
                    "Split virtically section count for inter-band correlation calculating")->default_val(IBCV_DEF_SECTIONS);
+    app.add_option_function<std::string>("--ibc-mode", [](const std::string & v) {
+        if (v == "pan") ips_.IBCOR_Mode = IBC_MODE_PAN;
+        else if (v == "mss") ips_.IBCOR_Mode = IBC_MODE_MSS;
+        else if (v == "compare") ips_.IBCOR_Mode = IBC_MODE_COMPARE;
+        else throw CLI::ValidationError("--ibc-mode", "should be one of pan, mss, compare");
+    }, "Inter-band correlation resolution: pan (upscale MSS slices), mss (downscale PAN slices), "
+       "compare (run both & report accuracy, use pan results)")->default_str("pan");
+    app.add_option("--ibc-min-valid", ips_.IBCOR_MinValid,
+                   "Correlate the most textured windows first and stop once every band has this many valid values, "
+                   "0 correlates all windows"
+                   )->default_val(0)->check([](const std::string & v) {
+        int n = atoi(v.c_str());
+        if (n != 0 && n < IBCV_MIN_COUNT) {
+            return "should be 0, or no less than " + std::to_string(IBCV_MIN_COUNT);
+        }
+        return std::string();
+    });
     app.add_option("--ibc-threshold", ips_.IBCOR_Threshold,
                    "Threshold of valid inter-band correlation calculated parameter value"
                    )->default_val(IBCV_DEF_THRESHOLD)->check([](const std::string & v) {
@@ -242,7 +426,7 @@ int ParseInputParametersFromCommandLineArguments(int argc, const char * argv[])
                    "Line offset for inter-band pixel alignment processing")->default_val(IBPA_DEFAULT_LINEOFFSET);
     app.add_option("--lines-section",
                    ips_.IBPA_BatchLines,
-                   "Line-per-section for inter-band pixel alignment processing")->default_val(IBPA_DEFAULT_BATCHLINES);
+                   "Line-per-section for inter-band pixel alignment processing (row stripe of analytic engine)")->default_val(IBPA_DEFAULT_BATCHLINES);
     app.add_option("--overlap-lines",
                    ips_.IBPA_OverlapLines,
                    "Overlapped lines for each sibling portion during inter-band pixel alignment processing"
@@ -277,16 +461,23 @@ void PreStitch() {
                  stp.sectionLines,
                  stp.overlapCols);
     
-    stt.CalcSttParameters(stp_.stThreshold, stp_.maxDeltaY, stp_.edgeCols);
+    ParamRecord params(PCACHE_KIND_STITCH, stt.SttCacheKey(stp.stThreshold, stp.maxDeltaY, stp.edgeCols,
+                                                                  stp.adaptiveTolerance, stp.timeBudget));
+    if (ParamCache::Lookup(params)) {
+        stt.ImportSttParams(params);
+    } else {
+        stt.CalcSttParameters(stp.stThreshold, stp.maxDeltaY, stp.edgeCols, stp.adaptiveTolerance, stp.timeBudget);
+        stt.ExportSttParams(params);
+        ParamCache::Store(params);
+    }
     
     if (!stp.onlyParamCalc) {
-        if (stp.doRRC) stt.DoRRC();
+        if (stp.doRRC) stt.DoRRC(stp.streamRRC, stp.rrcBlockLines);
         stt.PreStitch();
     }
 }
 
-void DefaultAction() {
-    const InputParameters & ip = ips_;
+void CheckRRCParameters(const InputParameters & ip) {
     if (ip.doRRC4PAN && ip.RRCParaPAN.length() == 0) {
         throw usage_error("RRC parameter file of PAN needed");
     }
@@ -297,22 +488,63 @@ void DefaultAction() {
         || ip.RRCParaMSS[3].length() == 0)) {
         throw usage_error("RRC parameter file of all MSS Bands needed");
     }
+}
+
+void InterBandCorrelationOnly(const std::string & coeffFilePath) {
+    const InputParameters & ip = ips_;
+    CheckRRCParameters(ip);
     
     PreProcessor pp(  ip.RawFilePAN
                     , ip.RawFileMSS
                     , ip.RRCParaPAN
                     , ip.RRCParaMSS);
-    pp.LoadPAN();
-    pp.LoadMSS();
+    ParamRecord params(PCACHE_KIND_IBCOR, pp.InterBandCacheKey(ip.IBCOR_Slices, ip.IBCOR_Sections, ip.IBCOR_Threshold,
+                                                                ip.IBCOR_Mode, ip.IBCOR_MinValid,
+                                                                ip.doRRC4PAN, ip.doRRC4MSS));
+    if (ParamCache::Lookup(params)) {
+        pp.ImportInterBandParams(params, ip.IBCOR_Slices, ip.IBCOR_Sections);
+    } else {
+        pp.LoadCorrelationSamples(ip.IBCOR_Sections, ip.doRRC4PAN, ip.doRRC4MSS);
+        pp.CalcInterBandCorrelation(ip.IBCOR_Slices, ip.IBCOR_Sections, ip.IBCOR_Threshold, ip.IBCOR_Mode,
+                                    ip.IBCOR_MinValid);
+        pp.ExportInterBandParams(params, ip.IBCOR_Slices, ip.IBCOR_Sections);
+        ParamCache::Store(params);
+    }
+    pp.WriteCorrelationCoefficients(coeffFilePath);
+}
+
+void DefaultAction() {
+    const InputParameters & ip = ips_;
+    CheckRRCParameters(ip);
     
-    if (ip.doRRC4PAN) {
+    PreProcessor pp(  ip.RawFilePAN
+                    , ip.RawFileMSS
+                    , ip.RRCParaPAN
+                    , ip.RRCParaMSS);
+    ParamRecord params(PCACHE_KIND_IBCOR, pp.InterBandCacheKey(ip.IBCOR_Slices, ip.IBCOR_Sections, ip.IBCOR_Threshold,
+                                                                ip.IBCOR_Mode, ip.IBCOR_MinValid,
+                                                                ip.doRRC4PAN, ip.doRRC4MSS));
+    bool cached = ParamCache::Lookup(params);
+    if (cached) pp.ImportInterBandParams(params, ip.IBCOR_Slices, ip.IBCOR_Sections);
+    
+    // PAN is only needed for correlation, or RRC-ed PAN output
+    bool needPAN = !cached || (ip.doRRC4PAN && ip.outputRrcPanTiff);
+    if (needPAN) pp.LoadPAN();
+    if (ip.doRRC4MSS) pp.LoadMSSWithRRC(); else pp.LoadMSS();
+    
+    if (ip.doRRC4PAN && needPAN) {
         pp.DoRRC4PAN();
         if (ip.outputRrcPanTiff) pp.WriteRRCedPAN_TIFF(ip.IBPA_LineOffset);
     }
     
-    if (ip.doRRC4MSS) pp.DoRRC4MSS();
-    
-    pp.CalcInterBandCorrelation(ip.IBCOR_Slices, ip.IBCOR_Sections, ip.IBCOR_Threshold);
+    if (cached) {
+        pp.UnloadPAN();
+    } else {
+        pp.CalcInterBandCorrelation(ip.IBCOR_Slices, ip.IBCOR_Sections, ip.IBCOR_Threshold, ip.IBCOR_Mode,
+                                    ip.IBCOR_MinValid);
+        pp.ExportInterBandParams(params, ip.IBCOR_Slices, ip.IBCOR_Sections);
+        ParamCache::Store(params);
+    }
     pp.DoInterBandAlignment(ip.IBPA_BatchLines, ip.IBPA_LineOffset, ip.IBPA_OverlapLines, ip.keepLeadingOverlappedLines);
 }
 
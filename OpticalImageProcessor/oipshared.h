@@ -52,11 +52,13 @@
 #define STT_DEF_PHCTHRHLD   0.4 // phaseCorrelate response threshold
 #define STT_DEF_MAXDELTAY   0.0 // max delta y value in phaseCorrelate result
 #define STT_DEF_EDGECOLS    0
+#define STT_ADAPTIVE_MIN    3   // valid sections needed before adaptive stitch estimation may stop
 
 #define STT_STEM_EXT        ".STT"
 #define PRESTT_STEM_EXT     ".PRESTT"
 #define RRC_STEM_EXT        ".RRC"
 #define IBPA_STEM_EXT       ".ALIGNED"
+#define IBCOEF_STEM_EXT     ".IBCOEF"
 #define TIFF_FILE_EXT       ".TIFF"
 #define RAW_FILE_EXT        ".RAW"
 #define AUX_FILE_EXT        ".AUX"
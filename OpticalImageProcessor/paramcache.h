@@ -0,0 +1,262 @@
+//
+//  paramcache.h
+//  OpticalImageProcessor
+//
+//  Created by Qiu PENG on 18/10/26.
+//
+
+#ifndef paramcache_h
+#define paramcache_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "oipshared.h"
+#include "CRC.h"
+
+BEGIN_NS(OIP)
+
+const int PCACHE_SAMPLE_BLOCKS = 17;                // blocks sampled per file, first & last block included
+const size_t PCACHE_SAMPLE_BYTES = 64 * 1024;       // bytes per sampled block
+#define PCACHE_DEF_DIR      ".oipcache"
+#define PCACHE_FILE_EXT     ".param"
+#define PCACHE_KIND_IBCOR   "ibcor"
+#define PCACHE_KIND_STITCH  "stitch"
+
+/// fast content fingerprint: two CRC-32 variants over file sizes, evenly sampled file blocks
+/// and option values; files are never read in full unless they are smaller than the samples
+class Fingerprint {
+public:
+    Fingerprint() : mCrc1(0), mCrc2(0), mEmpty(true) {}
+
+    Fingerprint & Add(const void * data, size_t size) {
+        if (mEmpty) {
+            mCrc1 = CRC::Calculate(data, size, Table1());
+            mCrc2 = CRC::Calculate(data, size, Table2());
+            mEmpty = false;
+        } else {
+            mCrc1 = CRC::Calculate(data, size, Table1(), mCrc1);
+            mCrc2 = CRC::Calculate(data, size, Table2(), mCrc2);
+        }
+        return *this;
+    }
+
+    Fingerprint & Add(const std::string & s) {
+        Add(s.data(), s.length());
+        return Add("\n", 1);
+    }
+
+    Fingerprint & Add(double v) {
+        return Add(std::string(xs("%.17g", v).s));
+    }
+
+    Fingerprint & AddFile(const std::string & filePath) {
+        scoped_ptr<FILE, FileDtor> f = fopen(filePath.c_str(), "rb");
+        if (f.is_null()) throw errno_error(xs("open file [%s] failed", filePath.c_str()).s);
+        if (fseeko(f, 0, SEEK_END)) throw errno_error(xs("seek file [%s] failed", filePath.c_str()).s);
+        size_t size = ftello(f);
+        Add((double)size);
+
+        std::unique_ptr<char[]> block(new char[PCACHE_SAMPLE_BYTES]);
+        size_t blocks = size <= PCACHE_SAMPLE_BLOCKS * PCACHE_SAMPLE_BYTES ? 1 : PCACHE_SAMPLE_BLOCKS;
+        size_t bytes = blocks == 1 ? size : PCACHE_SAMPLE_BYTES;
+        if (blocks == 1) block.reset(new char[std::max(size, (size_t)1)]);
+        for (size_t i = 0; i < blocks; ++i) {
+            off_t offset = blocks == 1 ? 0 : (off_t)((size - bytes) / (blocks - 1) * i);
+            if (fseeko(f, offset, SEEK_SET) || fread(block.get(), 1, bytes, f) != bytes) {
+                throw errno_error(xs("read file [%s] failed", filePath.c_str()).s);
+            }
+            Add(block.get(), bytes);
+        }
+        return *this;
+    }
+
+    std::string Hex() const {
+        return xs("%08x%08x", mCrc1, mCrc2).s;
+    }
+
+private:
+    static const CRC::Table<crcpp_uint32, 32> & Table1() {
+        static CRC::Table<crcpp_uint32, 32> table(CRC::CRC_32());
+        return table;
+    }
+    static const CRC::Table<crcpp_uint32, 32> & Table2() {
+        static CRC::Table<crcpp_uint32, 32> table(CRC::CRC_32_MPEG2());
+        return table;
+    }
+
+private:
+    crcpp_uint32 mCrc1;
+    crcpp_uint32 mCrc2;
+    bool mEmpty;
+};
+
+/// named double arrays of one kind of parameters, saved as text:
+/// `kind <kind>', `key <fingerprint>', then one `<name> <values ...>' line per array
+class ParamRecord {
+public:
+    explicit ParamRecord(const std::string & kind = "", const std::string & key = "") : mKind(kind), mKey(key) {}
+
+    const std::string & Kind() const { return mKind; }
+    const std::string & Key() const { return mKey; }
+
+    void Set(const std::string & name, const std::vector<double> & values) { mValues[name] = values; }
+    void Set(const std::string & name, double value) { mValues[name] = std::vector<double>(1, value); }
+    bool Has(const std::string & name) const { return mValues.find(name) != mValues.end(); }
+
+    const std::vector<double> & Get(const std::string & name, size_t count = 0) const {
+        auto it = mValues.find(name);
+        if (it == mValues.end()) {
+            throw std::runtime_error(xs("parameter `%s' not found in `%s' parameters", name.c_str(), mKind.c_str()).s);
+        }
+        if (count > 0 && it->second.size() != count) {
+            throw std::runtime_error(xs("parameter `%s' has %d value(s), %d expected",
+                                        name.c_str(), (int)it->second.size(), (int)count).s);
+        }
+        return it->second;
+    }
+
+    void Save(const std::string & filePath) const {
+        scoped_ptr<FILE, FileDtor> f = fopen(filePath.c_str(), "w");
+        if (f.is_null()) throw errno_error(xs("open file [%s] failed", filePath.c_str()).s);
+        fprintf(f, "kind %s\nkey %s\n", mKind.c_str(), mKey.c_str());
+        for (auto & kv : mValues) {
+            fprintf(f, "%s", kv.first.c_str());
+            for (double v : kv.second) fprintf(f, " %.17g", v);
+            fprintf(f, "\n");
+        }
+        if (ferror(f)) throw errno_error(xs("write file [%s] failed", filePath.c_str()).s);
+    }
+
+    static ParamRecord Load(const std::string & filePath) {
+        scoped_ptr<FILE, FileDtor> f = fopen(filePath.c_str(), "r");
+        if (f.is_null()) throw errno_error(xs("open parameter file [%s] failed", filePath.c_str()).s);
+
+        ParamRecord record;
+        std::string line;
+        for (int c; (c = fgetc(f)) != EOF || line.length() > 0; ) {
+            if (c != '\n' && c != EOF) {
+                line += (char)c;
+                continue;
+            }
+            size_t sp = line.find(' ');
+            std::string name = line.substr(0, sp);
+            std::string rest = sp == std::string::npos ? "" : line.substr(sp + 1);
+            if (name == "kind") record.mKind = rest;
+            else if (name == "key") record.mKey = rest;
+            else if (name.length() > 0) {
+                std::vector<double> values;
+                const char * p = rest.c_str();
+                for (char * end; ; p = end) {
+                    double v = strtod(p, &end);
+                    if (end == p) break;
+                    values.push_back(v);
+                }
+                record.mValues[name] = values;
+            }
+            line.clear();
+        }
+        if (record.mKind.length() == 0) {
+            throw std::runtime_error(xs("invalid parameter file [%s]: no `kind' line", filePath.c_str()).s);
+        }
+        return record;
+    }
+
+private:
+    std::string mKind;
+    std::string mKey;
+    std::map<std::string, std::vector<double>> mValues;
+};
+
+struct ParamCacheOptions {
+    std::string dir;        // cache directory, empty disables caching
+    bool refresh;           // ignore cached parameters, recompute & overwrite them
+    std::string importFile; // parameter file of another scene, used instead of cached or computed ones
+
+    ParamCacheOptions() : dir(PCACHE_DEF_DIR), refresh(false) {}
+
+    /// process-wide options set from command line
+    static ParamCacheOptions & Global() {
+        static ParamCacheOptions options;
+        return options;
+    }
+};
+
+/// `<dir>/<kind>-<fingerprint>.param' files of computed parameters, so reruns on the same inputs &
+/// options skip correlation entirely
+class ParamCache {
+public:
+    static std::string FilePath(const std::string & kind, const std::string & key,
+                                const ParamCacheOptions & options = ParamCacheOptions::Global()) {
+        std::filesystem::path path = options.dir;
+        path /= kind + "-" + key + PCACHE_FILE_EXT;
+        return path.string();
+    }
+
+    /// replace `record' with imported, or cached parameters of its kind & key, false if they should be computed
+    static bool Lookup(ParamRecord & record, const ParamCacheOptions & options = ParamCacheOptions::Global()) {
+        const std::string kind = record.Kind();
+        const std::string key = record.Key();
+        if (options.importFile.length() > 0) {
+            ParamRecord imported = ParamRecord::Load(options.importFile);
+            if (imported.Kind() != kind) {
+                throw std::invalid_argument(xs("parameter file [%s] holds `%s' parameters, `%s' expected",
+                                               options.importFile.c_str(), imported.Kind().c_str(), kind.c_str()).s);
+            }
+            OLOG("Imported %s parameters from file [%s].", kind.c_str(), options.importFile.c_str());
+            record = imported;
+            return true;
+        }
+        if (options.dir.length() == 0) return false;
+
+        auto path = FilePath(kind, key, options);
+        if (options.refresh) {
+            OLOG("Recomputing %s parameters (cache key %s).", kind.c_str(), key.c_str());
+            return false;
+        }
+        if (!std::filesystem::exists(path)) {
+            OLOG("No cached %s parameters (cache key %s), computing.", kind.c_str(), key.c_str());
+            return false;
+        }
+        ParamRecord cached;
+        try {
+            cached = ParamRecord::Load(path);
+        } catch (const std::exception & e) {
+            OLOG("Ignoring unreadable cached parameters [%s]: %s.", path.c_str(), e.what());
+            return false;
+        }
+        if (cached.Kind() != kind || cached.Key() != key) {
+            OLOG("Ignoring mismatched cached parameters [%s].", path.c_str());
+            return false;
+        }
+        OLOG("Using cached %s parameters from file [%s].", kind.c_str(), path.c_str());
+        record = cached;
+        return true;
+    }
+
+    /// save `record' under its kind & key, failures are logged only: the results are still valid
+    static void Store(const ParamRecord & record,
+                      const ParamCacheOptions & options = ParamCacheOptions::Global()) {
+        if (options.dir.length() == 0) return;
+        auto path = FilePath(record.Kind(), record.Key(), options);
+        auto temp = path + ".tmp";
+        try {
+            std::filesystem::create_directories(options.dir);
+            record.Save(temp);
+            std::filesystem::rename(temp, path);
+            OLOG("%s parameters cached to file [%s].", record.Kind().c_str(), path.c_str());
+        } catch (const std::exception & e) {
+            OLOG("Caching %s parameters to [%s] failed: %s.", record.Kind().c_str(), path.c_str(), e.what());
+        }
+    }
+};
+
+END_NS
+
+#endif /* paramcache_h */
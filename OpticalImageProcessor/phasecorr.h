@@ -0,0 +1,298 @@
+//
+//  phasecorr.h
+//  OpticalImageProcessor
+//
+//  Created by Qiu PENG on 18/10/26.
+//
+
+#ifndef phasecorr_h
+#define phasecorr_h
+
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "oipshared.h"
+#include "pixelops.h"
+#include "testimage.h"
+
+BEGIN_NS(OIP)
+
+const double PHC_SELFTEST_MAXERR = 1e-3; // px & response
+
+/// 2/3/5-smooth sizes factor into the fastest DFT radices
+inline bool IsSmoothSize(int n) {
+    if (n <= 0) return false;
+    for (int p : { 2, 3, 5 }) while (n % p == 0) n /= p;
+    return n == 1;
+}
+
+/// largest 2/3/5-smooth size <= `n' that is a multiple of `multiple' (which should be smooth itself),
+/// 0 if none; used to crop correlation windows instead of zero-padding them
+inline int SmoothSize(int n, int multiple = 1) {
+    for (int m = n - n % multiple; m > 0; m -= multiple) {
+        if (IsSmoothSize(m)) return m;
+    }
+    return 0;
+}
+
+/// scratch matrices of one padded DFT size
+struct FFTWorkspace {
+    cv::Mat padded;
+    cv::Mat spectrum;
+    cv::Mat cross;
+    cv::Mat surface;
+};
+
+/// process-wide cache of DFT workspaces keyed by padded size, so correlators of the same window size
+/// (every slice, band & section) reuse buffers instead of re-allocating them.
+/// OpenCV gives no access to its DFT plans/twiddles, buffers are what can be kept across calls.
+class FFTWorkspaceCache {
+public:
+    static std::unique_ptr<FFTWorkspace> Acquire(int rows, int cols) {
+        Cache & c = Shared();
+        std::lock_guard<std::mutex> lock(c.lock);
+        auto & list = c.free[std::make_pair(rows, cols)];
+        if (list.empty()) return std::unique_ptr<FFTWorkspace>(new FFTWorkspace());
+        std::unique_ptr<FFTWorkspace> ws = std::move(list.back());
+        list.pop_back();
+        return ws;
+    }
+
+    static void Release(int rows, int cols, std::unique_ptr<FFTWorkspace> ws) {
+        if (!ws) return;
+        Cache & c = Shared();
+        std::lock_guard<std::mutex> lock(c.lock);
+        c.free[std::make_pair(rows, cols)].push_back(std::move(ws));
+    }
+
+    /// free all cached buffers, call when a correlation stage is done
+    static void Clear() {
+        Cache & c = Shared();
+        std::lock_guard<std::mutex> lock(c.lock);
+        c.free.clear();
+    }
+
+private:
+    struct Cache {
+        std::mutex lock;
+        std::map<std::pair<int, int>, std::vector<std::unique_ptr<FFTWorkspace>>> free;
+    };
+    static Cache & Shared() {
+        static Cache cache;
+        return cache;
+    }
+};
+
+/// phase correlation against a fixed base image, same math as `cv::phaseCorrelate()'
+/// (optimal DFT size zero padding, optional window, normalized cross-power spectrum,
+/// fft-shift, 5x5 weighted centroid around the peak, response / (M*N)),
+/// but the padded & windowed base spectrum is computed once and reused for every `Correlate()'.
+/// not thread safe: use one instance per thread.
+class PhaseCorrelator {
+public:
+    PhaseCorrelator() : mRows(0), mCols(0), mM(0), mN(0) {}
+
+    /// `base' should be CV_32FC1 or CV_16UC1 (any step, i.e. an ROI, converted straight into the padded
+    /// DFT buffer), `window' CV_32FC1 of the same size or empty
+    explicit PhaseCorrelator(const cv::Mat & base, const cv::Mat & window = cv::Mat())
+    : mRows(0), mCols(0), mM(0), mN(0) {
+        SetBase(base, window);
+    }
+
+    PhaseCorrelator(const PhaseCorrelator &) = delete;
+    PhaseCorrelator & operator=(const PhaseCorrelator &) = delete;
+
+    ~PhaseCorrelator() {
+        FFTWorkspaceCache::Release(mM, mN, std::move(mWork));
+    }
+
+    void SetBase(const cv::Mat & base, const cv::Mat & window = cv::Mat()) {
+        if (!IsSupportedType(base)) throw std::invalid_argument("PhaseCorrelator: base image should be CV_32FC1 or CV_16UC1");
+        if (!window.empty() && (window.type() != CV_32FC1 || window.rows != base.rows || window.cols != base.cols)) {
+            throw std::invalid_argument("PhaseCorrelator: window should be CV_32FC1 of the same size as base image");
+        }
+        FFTWorkspaceCache::Release(mM, mN, std::move(mWork));
+        mRows = base.rows;
+        mCols = base.cols;
+        mM = cv::getOptimalDFTSize(mRows);
+        mN = cv::getOptimalDFTSize(mCols);
+        mWork = FFTWorkspaceCache::Acquire(mM, mN);
+        mWindow.release();
+        if (!window.empty()) Pad(window, mWindow, false);
+
+        Pad(base, mWork->padded, true);
+        cv::dft(mWork->padded, mBaseSpectrum, cv::DFT_COMPLEX_OUTPUT);
+    }
+
+    bool empty() const { return mBaseSpectrum.empty(); }
+
+    /// shift of `image' relative to base, i.e. `cv::phaseCorrelate(base, image, window, response)'
+    cv::Point2d Correlate(const cv::Mat & image, double * response = NULL) {
+        if (empty()) throw std::logic_error("PhaseCorrelator: base image not set");
+        if (!IsSupportedType(image) || image.rows != mRows || image.cols != mCols) {
+            throw std::invalid_argument("PhaseCorrelator: image should be CV_32FC1 or CV_16UC1 of the same size as base image");
+        }
+
+        FFTWorkspace & ws = *mWork;
+        Pad(image, ws.padded, true);
+        cv::dft(ws.padded, ws.spectrum, cv::DFT_COMPLEX_OUTPUT);
+        cv::mulSpectrums(mBaseSpectrum, ws.spectrum, ws.cross, 0, true);
+
+        // FF* / |FF*|, with the same epsilon as OpenCV's divSpectrums()
+        for (int y = 0; y < ws.cross.rows; ++y) {
+            float * p = ws.cross.ptr<float>(y);
+            for (int x = 0; x < ws.cross.cols * 2; x += 2) {
+                double re = p[x], im = p[x + 1];
+                double mag = sqrt(re * re + im * im);
+                double denom = mag * mag + FLT_EPSILON;
+                p[x]     = (float)(re * mag / denom);
+                p[x + 1] = (float)(im * mag / denom);
+            }
+        }
+        cv::idft(ws.cross, ws.surface, cv::DFT_REAL_OUTPUT);
+        FFTShift(ws.surface);
+
+        cv::Point peak;
+        cv::minMaxLoc(ws.surface, NULL, NULL, NULL, &peak);
+        double sum = 0.0;
+        cv::Point2d t = WeightedCentroid(ws.surface, peak, 2, sum);
+        if (response) *response = sum / ((double)mM * mN);
+        return cv::Point2d(mN / 2.0 - t.x, mM / 2.0 - t.y);
+    }
+
+    /// time forward DFT (no padding) & `Correlate()' (padded to optimal DFT size) of `rows' x `cols'
+    /// windows around `cols', to show the cost of large prime factors in window sizes
+    static void Benchmark(int rows, int cols, int repeat = 3, int span = 32) {
+        std::vector<int> widths;
+        for (int w = std::max(cols - span, 8); w <= cols + span; w += 4) widths.push_back(w);
+        for (int w : { cols, cv::getOptimalDFTSize(cols), SmoothSize(cols), SmoothSize(cols, MSS_BANDS) }) {
+            if (w > 0) widths.push_back(w);
+        }
+        std::sort(widths.begin(), widths.end());
+        widths.erase(std::unique(widths.begin(), widths.end()), widths.end());
+
+        OLOG("DFT benchmark: %d rows (smooth: %s), best of %d run(s):", rows, IsSmoothSize(rows) ? "yes" : "no", repeat);
+        RLOG("|  cols | smooth | padded to | dft (s)  | correlate (s) |");
+        RLOG("--------------------------------------------------------");
+        cv::Mat image(rows, widths.back(), CV_32FC1);
+        uint32_t seed = 0x3C6EF372;
+        for (int y = 0; y < image.rows; ++y) {
+            float * p = image.ptr<float>(y);
+            for (int x = 0; x < image.cols; ++x) {
+                seed = seed * 1664525 + 1013904223;
+                p[x] = (float)(seed >> 20);
+            }
+        }
+        for (int w : widths) {
+            cv::Mat win = image.colRange(0, w).clone();
+            cv::Mat shifted = image.colRange(widths.back() - w, widths.back()).clone();
+            PhaseCorrelator pc(win);
+            double tDft = 1e30, tCorr = 1e30;
+            cv::Mat spectrum;
+            for (int r = 0; r < repeat; ++r) {
+                stop_watch sw;
+                cv::dft(win, spectrum, cv::DFT_COMPLEX_OUTPUT);
+                tDft = std::min(tDft, sw.tick().ellapsed);
+                pc.Correlate(shifted);
+                tCorr = std::min(tCorr, sw.tick().ellapsed);
+            }
+            RLOG("| %5d |   %s  |   %5d   | %8.4f |   %8.4f    |",
+                 w, IsSmoothSize(w) ? "yes" : " no", cv::getOptimalDFTSize(w), tDft, tCorr);
+        }
+        FFTWorkspaceCache::Clear();
+    }
+
+    /// compare with `cv::phaseCorrelate()' on synthetic shifted textures, throws on mismatch
+    static void SelfTest(int rows = 1200, int cols = 500) {
+        cv::Mat base = TestImage::SyntheticTexture(rows + 16, cols + 16, CV_32FC1, 0x2545F491, 1000.0, 300.0, 20);
+        cv::Mat ref = base(cv::Rect(8, 8, cols, rows)).clone();
+        cv::Mat window;
+        cv::createHanningWindow(window, cv::Size(cols, rows), CV_32F);
+        const int shifts[][2] = { {0, 0}, {3, -2}, {-5, 7}, {8, 1} };
+        for (int w = 0; w < 2; ++w) {
+            PhaseCorrelator pc(ref, w ? window : cv::Mat());
+            for (auto & s : shifts) {
+                cv::Mat img = base(cv::Rect(8 + s[0], 8 + s[1], cols, rows)).clone();
+                double r0 = 0.0, r1 = 0.0;
+                cv::Point2d v0 = cv::phaseCorrelate(ref, img, w ? window : cv::Mat(), &r0);
+                cv::Point2d v1 = pc.Correlate(img, &r1);
+                double err = std::max(std::max(fabs(v0.x - v1.x), fabs(v0.y - v1.y)), fabs(r0 - r1));
+                OLOG("PhaseCorrelator [%s window, shift %d,%d]: OpenCV (%.4f, %.4f, %.4f), cached (%.4f, %.4f, %.4f).",
+                     w ? "hanning" : "no", s[0], s[1], v0.x, v0.y, r0, v1.x, v1.y, r1);
+                if (!(err <= PHC_SELFTEST_MAXERR)) {
+                    throw std::runtime_error(xs("PhaseCorrelator deviates from cv::phaseCorrelate() by %g", err).s);
+                }
+            }
+        }
+    }
+
+private:
+    static bool IsSupportedType(const cv::Mat & m) {
+        return m.type() == CV_32FC1 || m.type() == CV_16UC1;
+    }
+
+    /// zero padded to DFT size & multiplied by window if `windowed', uint16 input is converted in the same pass
+    void Pad(const cv::Mat & src, cv::Mat & dst, bool windowed) const {
+        const cv::Mat & window = windowed ? mWindow : cv::Mat();
+        if (src.type() == CV_16UC1) {
+            PixelOps::U16ToF32Padded(src, dst, mM, mN, window);
+            return;
+        }
+        cv::copyMakeBorder(src, dst, 0, mM - src.rows, 0, mN - src.cols, cv::BORDER_CONSTANT, cv::Scalar::all(0));
+        if (!window.empty()) cv::multiply(window, dst, dst);
+    }
+
+    /// swap quadrants so that zero shift lands at (cols/2, rows/2), as OpenCV does
+    static void FFTShift(cv::Mat & m) {
+        int xMid = m.cols >> 1;
+        int yMid = m.rows >> 1;
+        if (xMid == 0 || yMid == 0) return;
+        cv::Mat q0(m, cv::Rect(0,    0,    xMid, yMid));
+        cv::Mat q1(m, cv::Rect(xMid, 0,    xMid, yMid));
+        cv::Mat q2(m, cv::Rect(0,    yMid, xMid, yMid));
+        cv::Mat q3(m, cv::Rect(xMid, yMid, xMid, yMid));
+        cv::Mat tmp;
+        q0.copyTo(tmp); q3.copyTo(q0); tmp.copyTo(q3);
+        q1.copyTo(tmp); q2.copyTo(q1); tmp.copyTo(q2);
+    }
+
+    static cv::Point2d WeightedCentroid(const cv::Mat & src, cv::Point peak, int radius, double & sum) {
+        int minr = std::max(peak.y - radius, 0);
+        int maxr = std::min(peak.y + radius, src.rows - 1);
+        int minc = std::max(peak.x - radius, 0);
+        int maxc = std::min(peak.x + radius, src.cols - 1);
+        double cx = 0.0, cy = 0.0;
+        sum = 0.0;
+        for (int y = minr; y <= maxr; ++y) {
+            const float * p = src.ptr<float>(y);
+            for (int x = minc; x <= maxc; ++x) {
+                cx  += (double)x * p[x];
+                cy  += (double)y * p[x];
+                sum += (double)p[x];
+            }
+        }
+        double d = sum + DBL_EPSILON;
+        return cv::Point2d(cx / d, cy / d);
+    }
+
+private:
+    int mRows, mCols;   // size of input images
+    int mM, mN;         // padded DFT size
+    cv::Mat mWindow;
+    cv::Mat mBaseSpectrum;
+    std::unique_ptr<FFTWorkspace> mWork; // scratch, returned to `FFTWorkspaceCache' when done
+};
+
+END_NS
+
+#endif /* phasecorr_h */
@@ -0,0 +1,239 @@
+//
+//  pixelops.h
+//  OpticalImageProcessor
+//
+//  Created by Qiu PENG on 18/10/26.
+//
+
+#ifndef pixelops_h
+#define pixelops_h
+
+#include <stdint.h>
+#include <string.h>
+#include <stdexcept>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "oipshared.h"
+#include "simd.h"
+
+BEGIN_NS(OIP)
+
+/// pixel format conversion kernels feeding correlation, SIMD path is chosen at runtime
+class PixelOps {
+public:
+    /// dst = float(src) [* window], `rows' x `cols' pixels, strides are in elements.
+    /// `window' may be NULL; every SIMD path is bit-exact with the scalar one (single rounding `mul').
+    static void U16ToF32(const uint16_t * src, size_t srcStride,
+                         float * dst, size_t dstStride,
+                         int rows, int cols,
+                         const float * window = NULL, size_t winStride = 0,
+                         SimdLevel level = Simd::Level()) {
+        for (int y = 0; y < rows; ++y) {
+            const uint16_t * s = src + y * srcStride;
+            float * d = dst + y * dstStride;
+            const float * w = window ? window + y * winStride : NULL;
+            int x = 0;
+#if OIP_SIMD_X86
+            if (level >= SIMD_AVX2) x = w ? U16ToF32WindowAVX2(s, d, w, cols) : U16ToF32AVX2(s, d, cols);
+            else if (level >= SIMD_SSE41) x = w ? U16ToF32WindowSSE41(s, d, w, cols) : U16ToF32SSE41(s, d, cols);
+#endif
+            if (w) {
+                for (; x < cols; ++x) d[x] = (float)s[x] * w[x];
+            } else {
+                for (; x < cols; ++x) d[x] = (float)s[x];
+            }
+        }
+    }
+
+    /// convert a CV_16UC1 ROI (any step) into the top-left corner of a CV_32FC1 `rows' x `cols' buffer,
+    /// multiplied by `window' (CV_32FC1, at least the ROI size) if not empty, the rest is zero filled.
+    /// `dst' is only re-allocated if its size or type differs, so it can be kept across calls.
+    static void U16ToF32Padded(const cv::Mat & src, cv::Mat & dst, int rows, int cols,
+                               const cv::Mat & window = cv::Mat()) {
+        if (src.type() != CV_16UC1) throw std::invalid_argument("U16ToF32Padded: source should be CV_16UC1");
+        if (src.rows > rows || src.cols > cols) throw std::invalid_argument("U16ToF32Padded: source larger than buffer");
+        dst.create(rows, cols, CV_32FC1);
+        U16ToF32((const uint16_t *)src.data, src.step[0] / sizeof(uint16_t),
+                 (float *)dst.data, dst.step[0] / sizeof(float),
+                 src.rows, src.cols,
+                 window.empty() ? NULL : (const float *)window.data,
+                 window.empty() ? 0 : window.step[0] / sizeof(float));
+        if (src.cols < cols) {
+            for (int y = 0; y < src.rows; ++y) {
+                memset(dst.ptr<float>(y) + src.cols, 0, (cols - src.cols) * sizeof(float));
+            }
+        }
+        for (int y = src.rows; y < rows; ++y) {
+            memset(dst.ptr<float>(y), 0, cols * sizeof(float));
+        }
+    }
+
+    /// mean squared gradient (x & y forward differences) over every `rowStep'-th row of a `rows' x `cols'
+    /// uint16 image, a cheap texture measure; sums are exact 64-bit integers, so every SIMD path matches scalar
+    static double GradientEnergy(const uint16_t * src, size_t stride, int rows, int cols, int rowStep = 1,
+                                 SimdLevel level = Simd::Level()) {
+        if (rowStep < 1) throw std::invalid_argument("GradientEnergy: row step should be a positive integer");
+        int64_t sum = 0, count = 0;
+        for (int y = 0; y + 1 < rows; y += rowStep) {
+            const uint16_t * s = src + y * stride;
+            const uint16_t * n = s + stride;
+            int x = 0;
+#if OIP_SIMD_X86
+            if (level >= SIMD_AVX2) x = GradientEnergyAVX2(s, n, cols, sum);
+            else if (level >= SIMD_SSE41) x = GradientEnergySSE41(s, n, cols, sum);
+#endif
+            for (; x + 1 < cols; ++x) {
+                int64_t gx = (int)s[x + 1] - s[x];
+                int64_t gy = (int)n[x] - s[x];
+                sum += gx * gx + gy * gy;
+            }
+            count += cols - 1;
+        }
+        return count > 0 ? (double)sum / count : 0.0;
+    }
+
+    /// CV_16UC1 ROI version of the above
+    static double GradientEnergy(const cv::Mat & src, int rowStep = 1) {
+        if (src.type() != CV_16UC1) throw std::invalid_argument("GradientEnergy: source should be CV_16UC1");
+        return GradientEnergy((const uint16_t *)src.data, src.step[0] / sizeof(uint16_t), src.rows, src.cols, rowStep);
+    }
+
+    /// bit-exactness check of every available SIMD path against the scalar path, throws on mismatch
+    static void SelfTest(int rows = 64, int cols = 1229) {
+        size_t srcStride = cols + 7, dstStride = cols + 3;
+        std::vector<uint16_t> src(rows * srcStride);
+        std::vector<float> window(rows * cols);
+        uint32_t seed = 0xBB67AE85;
+        for (auto & v : src) { seed = seed * 1664525 + 1013904223; v = (uint16_t)(seed >> 16); }
+        for (auto & v : window) { seed = seed * 1664525 + 1013904223; v = (seed >> 8) / 16777216.0f; }
+
+        for (int w = 0; w < 2; ++w) {
+            const float * win = w ? window.data() : NULL;
+            std::vector<float> expect(rows * dstStride, -1.0f);
+            U16ToF32(src.data(), srcStride, expect.data(), dstStride, rows, cols, win, cols, SIMD_SCALAR);
+            for (int l = SIMD_SSE41; l <= Simd::Level(); ++l) {
+                std::vector<float> actual(rows * dstStride, -1.0f);
+                U16ToF32(src.data(), srcStride, actual.data(), dstStride, rows, cols, win, cols, (SimdLevel)l);
+                size_t diff = 0;
+                for (size_t i = 0; i < actual.size(); ++i) {
+                    if (memcmp(&actual[i], &expect[i], sizeof(float))) diff++;
+                }
+                OLOG("U16ToF32 [%s, %s window]: %s pixels compared, %s mismatch(es).",
+                     Simd::Name((SimdLevel)l), w ? "with" : "no",
+                     comma_sep(rows * cols).sep(),
+                     comma_sep(diff).sep());
+                if (diff > 0) {
+                    throw std::runtime_error(xs("U16ToF32 [%s] is not bit-exact with scalar conversion",
+                                                Simd::Name((SimdLevel)l)).s);
+                }
+            }
+        }
+
+        double expect = GradientEnergy(src.data(), srcStride, rows, cols, 3, SIMD_SCALAR);
+        for (int l = SIMD_SSE41; l <= Simd::Level(); ++l) {
+            double actual = GradientEnergy(src.data(), srcStride, rows, cols, 3, (SimdLevel)l);
+            OLOG("GradientEnergy [%s]: %.6f, scalar %.6f.", Simd::Name((SimdLevel)l), actual, expect);
+            if (actual != expect) {
+                throw std::runtime_error(xs("GradientEnergy [%s] differs from scalar result", Simd::Name((SimdLevel)l)).s);
+            }
+        }
+    }
+
+private:
+#if OIP_SIMD_X86
+    OIP_TARGET("sse4.1")
+    static int U16ToF32SSE41(const uint16_t * s, float * d, int cols) {
+        int x = 0;
+        for (; x + 8 <= cols; x += 8) {
+            __m128i px = _mm_loadu_si128((const __m128i *)(s + x));
+            _mm_storeu_ps(d + x,     _mm_cvtepi32_ps(_mm_cvtepu16_epi32(px)));
+            _mm_storeu_ps(d + x + 4, _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(px, 8))));
+        }
+        return x;
+    }
+
+    OIP_TARGET("sse4.1")
+    static int U16ToF32WindowSSE41(const uint16_t * s, float * d, const float * w, int cols) {
+        int x = 0;
+        for (; x + 8 <= cols; x += 8) {
+            __m128i px = _mm_loadu_si128((const __m128i *)(s + x));
+            __m128 f0 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(px));
+            __m128 f1 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(px, 8)));
+            _mm_storeu_ps(d + x,     _mm_mul_ps(f0, _mm_loadu_ps(w + x)));
+            _mm_storeu_ps(d + x + 4, _mm_mul_ps(f1, _mm_loadu_ps(w + x + 4)));
+        }
+        return x;
+    }
+
+    /// vpmovzxwd + vcvtdq2ps, 16 pixels per iteration
+    OIP_TARGET("avx2")
+    static int U16ToF32AVX2(const uint16_t * s, float * d, int cols) {
+        int x = 0;
+        for (; x + 16 <= cols; x += 16) {
+            __m256i px = _mm256_loadu_si256((const __m256i *)(s + x));
+            _mm256_storeu_ps(d + x,     _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(px))));
+            _mm256_storeu_ps(d + x + 8, _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(px, 1))));
+        }
+        return x;
+    }
+
+    OIP_TARGET("avx2")
+    static int U16ToF32WindowAVX2(const uint16_t * s, float * d, const float * w, int cols) {
+        int x = 0;
+        for (; x + 16 <= cols; x += 16) {
+            __m256i px = _mm256_loadu_si256((const __m256i *)(s + x));
+            __m256 f0 = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(px)));
+            __m256 f1 = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(px, 1)));
+            _mm256_storeu_ps(d + x,     _mm256_mul_ps(f0, _mm256_loadu_ps(w + x)));
+            _mm256_storeu_ps(d + x + 8, _mm256_mul_ps(f1, _mm256_loadu_ps(w + x + 8)));
+        }
+        return x;
+    }
+
+    /// squares of 32-bit differences as 64-bit products: even lanes directly, odd lanes shifted down
+    OIP_TARGET("sse4.1")
+    static int GradientEnergySSE41(const uint16_t * s, const uint16_t * n, int cols, int64_t & sum) {
+        __m128i acc = _mm_setzero_si128();
+        int x = 0;
+        for (; x + 5 <= cols; x += 4) {
+            __m128i c  = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(s + x)));
+            __m128i gx = _mm_sub_epi32(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(s + x + 1))), c);
+            __m128i gy = _mm_sub_epi32(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(n + x))), c);
+            acc = _mm_add_epi64(acc, _mm_mul_epi32(gx, gx));
+            acc = _mm_add_epi64(acc, _mm_mul_epi32(gy, gy));
+            gx = _mm_srli_epi64(gx, 32);
+            gy = _mm_srli_epi64(gy, 32);
+            acc = _mm_add_epi64(acc, _mm_mul_epi32(gx, gx));
+            acc = _mm_add_epi64(acc, _mm_mul_epi32(gy, gy));
+        }
+        sum += _mm_extract_epi64(acc, 0) + _mm_extract_epi64(acc, 1);
+        return x;
+    }
+
+    OIP_TARGET("avx2")
+    static int GradientEnergyAVX2(const uint16_t * s, const uint16_t * n, int cols, int64_t & sum) {
+        __m256i acc = _mm256_setzero_si256();
+        int x = 0;
+        for (; x + 9 <= cols; x += 8) {
+            __m256i c  = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(s + x)));
+            __m256i gx = _mm256_sub_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(s + x + 1))), c);
+            __m256i gy = _mm256_sub_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(n + x))), c);
+            acc = _mm256_add_epi64(acc, _mm256_mul_epi32(gx, gx));
+            acc = _mm256_add_epi64(acc, _mm256_mul_epi32(gy, gy));
+            gx = _mm256_srli_epi64(gx, 32);
+            gy = _mm256_srli_epi64(gy, 32);
+            acc = _mm256_add_epi64(acc, _mm256_mul_epi32(gx, gx));
+            acc = _mm256_add_epi64(acc, _mm256_mul_epi32(gy, gy));
+        }
+        __m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        sum += _mm_extract_epi64(half, 0) + _mm_extract_epi64(half, 1);
+        return x;
+    }
+#endif
+};
+
+END_NS
+
+#endif /* pixelops_h */
@@ -10,6 +10,7 @@
 
 #include <stdio.h>
 #include <algorithm>
+#include <mutex>
 
 #include <opencv2/core/mat.hpp>
 #include <opencv2/imgproc.hpp>
@@ -18,6 +19,10 @@
 
 #include "oipshared.h"
 #include "imageop.h"
+#include "registrar.h"
+#include "paramcache.h"
+#include "warp.h"
+#include "tiffwriter.h"
 BEGIN_NS(OIP)
 
 struct InterBandShift {
@@ -27,6 +32,12 @@ struct InterBandShift {
     int cx; // center-x: in pixel
 };
 
+enum IBCMode {
+    IBC_MODE_PAN = 0,   // upscale MSS band slices to PAN resolution (cubic) before correlating
+    IBC_MODE_MSS,       // downscale PAN base slice to MSS resolution (area), shifts rescaled to PAN pixels
+    IBC_MODE_COMPARE,   // run both, report deviation of MSS mode from PAN mode, keep PAN mode results
+};
+
 class PreProcessor {
 public:
     PreProcessor(const std::string & panFile,
@@ -53,30 +64,108 @@ public:
         mImagePAN = (uint16_t *)IMO::LoadRawImage(mPanFile, 0, 0, mSizePAN);
     }
     
-    void LoadMSS() {
+    /// read & split interleaved MSS into band planes block by block,
+    /// peak memory is the band planes plus `RRC_STREAM_BUFFERS' blocks of `blockLines' lines
+    void LoadMSS(int blockLines = RRC_STREAM_BLOCKLINES) {
         OLOG("Loading MSS raw image ...");
-        scoped_ptr<uint16_t> mssMixed = (uint16_t *)IMO::LoadRawImage(mMssFile, 0, 0, mSizeMSS);
+        SplitMSS(NULL, blockLines);
+    }
+    
+    /// fused `LoadMSS()' & `DoRRC4MSS()': each band segment is corrected right after being
+    /// split while still in cache, so the band planes are written only once
+    void LoadMSSWithRRC(int blockLines = RRC_STREAM_BLOCKLINES) {
+        std::unique_ptr<RRCKernel> kernels[MSS_BANDS];
+        const RRCKernel * kernelPtrs[MSS_BANDS];
+        BuildRRCKernels4MSS(kernels);
+        for (int b = 0; b < MSS_BANDS; ++b) kernelPtrs[b] = kernels[b].get();
         
-        // split MSS 4 bands
-        OLOG("Splitting %d bands of MSS image ...", MSS_BANDS);
-        int bandBytesPerLine = PIXELS_PER_LINE * BYTES_PER_PIXEL / MSS_BANDS;
-        int bandPixelsPerLine = PIXELS_PER_LINE / MSS_BANDS; // MSS_BANDS: should always divisible by PIXELS_PER_LINE
-        for (int i = 0; i < MSS_BANDS; ++i) {
-            mImageBandMSS[i].attach(new uint16_t[mSizeMSS / MSS_BANDS]); // obsolte: `+1' for in case of indivisible
+        OLOG("Loading MSS raw image with fused RRC (%d threads) ...", ThreadPool::Shared().Size());
+        SplitMSS(kernelPtrs, blockLines);
+    }
+    
+    /// positioned reads of only the PAN & MSS rows correlated by `CalcInterBandCorrelation()' with the
+    /// same `sections', RRC-ed as requested; correlation then runs without `LoadPAN()' & `LoadMSS()'
+    void LoadCorrelationSamples(int sections = IBCV_DEF_SECTIONS, bool rrc4PAN = false, bool rrc4MSS = true) {
+        if (sections <= 0) {
+            throw std::invalid_argument("LoadCorrelationSamples: section count should be a positive integer");
         }
+        if (sections > 1 && sections * CORRELATION_LINES > mLinesPAN) {
+            throw std::invalid_argument(xs("LoadCorrelationSamples: too many sections (%d lines per section), "
+                                           "not enough total PAN data lines", CORRELATION_LINES).s);
+        }
+        int baseRows, baseRowGap;
+        CorrelationSectionRows(sections, baseRows, baseRowGap);
+        int bandRows = baseRows / MSS_BANDS;
+        int bandRowGap = baseRowGap / MSS_BANDS;
+        int bandPixelsPerLine = PIXELS_PER_LINE / MSS_BANDS;
+        size_t lineBytes = PIXELS_PER_LINE * BYTES_PER_PIXEL;
         
-        stop_watch::rst();
-        for (size_t i = 0; i < mLinesMSS; ++i) {
+        std::unique_ptr<RRCKernel> panKernel;
+        std::unique_ptr<RRCKernel> bandKernels[MSS_BANDS];
+        if (rrc4PAN) {
+            mRRCParamPAN = IMO::LoadRRCParamFile(mRrcPanFile.c_str(), PIXELS_PER_LINE);
+            panKernel.reset(new RRCKernel(mRRCParamPAN, PIXELS_PER_LINE));
+        }
+        if (rrc4MSS) BuildRRCKernels4MSS(bandKernels);
+        
+        OLOG("Loading %d correlation section(s) of %d PAN / %d MSS lines ...", sections, baseRows, bandRows);
+        mSamplePAN.assign(sections, cv::Mat());
+        for (int b = 0; b < MSS_BANDS; ++b) mSampleMSS[b].assign(sections, cv::Mat());
+        RRCVerifyStats verifiedPAN, verifiedMSS;
+        std::mutex verifyLock;
+        stop_watch sw;
+        ThreadPool::Shared().ParallelFor(sections, [&](int sec, int) {
+            RRCVerifyStats secPAN, secMSS;
+            size_t size = 0;
+            size_t secRowStart = baseRowGap + sec * (baseRows + baseRowGap);
+            cv::Mat pan(baseRows, PIXELS_PER_LINE, CV_16UC1);
+            IMO::ReadFileContent(mPanFile, size, secRowStart * lineBytes, baseRows * lineBytes, (char *)pan.data);
+            if (size != baseRows * lineBytes) {
+                throw std::runtime_error(xs("read PAN raw image file failed at line %s", comma_sep(secRowStart).sep()).s);
+            }
+            for (int y = 0; panKernel && y < baseRows; ++y) panKernel->ApplyLineVerified(pan.ptr<uint16_t>(y), secPAN);
+            mSamplePAN[sec] = pan;
+            
+            size_t secBandRowStart = bandRowGap + sec * (bandRows + bandRowGap);
+            std::unique_ptr<uint16_t[]> lines(new uint16_t[(size_t)bandRows * PIXELS_PER_LINE]);
+            IMO::ReadFileContent(mMssFile, size, secBandRowStart * lineBytes, bandRows * lineBytes, (char *)lines.get());
+            if (size != bandRows * lineBytes) {
+                throw std::runtime_error(xs("read MSS raw image file failed at line %s", comma_sep(secBandRowStart).sep()).s);
+            }
             for (int b = 0; b < MSS_BANDS; ++b) {
-                memcpy(mImageBandMSS[b].get() + i * bandPixelsPerLine,
-                       mssMixed.get() + i * PIXELS_PER_LINE + b * bandPixelsPerLine,
-                       bandBytesPerLine);
+                cv::Mat band(bandRows, bandPixelsPerLine, CV_16UC1);
+                for (int y = 0; y < bandRows; ++y) {
+                    uint16_t * line = band.ptr<uint16_t>(y);
+                    memcpy(line, lines.get() + (size_t)y * PIXELS_PER_LINE + b * bandPixelsPerLine, bandPixelsPerLine * BYTES_PER_PIXEL);
+                    if (bandKernels[b]) bandKernels[b]->ApplyLineVerified(line, secMSS);
+                }
+                mSampleMSS[b][sec] = band;
             }
+            std::lock_guard<std::mutex> guard(verifyLock);
+            verifiedPAN.Merge(secPAN);
+            verifiedMSS.Merge(secMSS);
+        });
+        if (panKernel) {
+            verifiedPAN.Log(panKernel->Options());
+            verifiedPAN.Check(panKernel->Options());
         }
-        auto es = stop_watch::tik().ellapsed;
-        OLOG("ReadMSS(): split done in %s seconds (%s MBps).",
+        if (rrc4MSS) {
+            verifiedMSS.Log(bandKernels[0]->Options());
+            verifiedMSS.Check(bandKernels[0]->Options());
+        }
+        auto es = sw.tick().ellapsed;
+        size_t bytes = (size_t)sections * (baseRows + bandRows) * lineBytes;
+        OLOG("LoadCorrelationSamples(): %s bytes read%s in %s seconds (%s MBps), %.2f%% of PAN & MSS files.",
+             comma_sep(bytes).sep(),
+             rrc4PAN || rrc4MSS ? " & RRC-ed" : "",
              comma_sep(es).sep(),
-             comma_sep(mSizeMSS/es/1024.0/1024.0).sep());
+             comma_sep(bytes/es/1024.0/1024.0).sep(),
+             100.0 * bytes / (mSizePAN + mSizeMSS));
+    }
+    
+    void UnloadCorrelationSamples() {
+        mSamplePAN.clear();
+        for (int i = 0; i < MSS_BANDS; ++i) mSampleMSS[i].clear();
     }
     
     void UnloadPAN() {
@@ -85,10 +174,6 @@ public:
     void UnloadMSS() {
         for (int i = 0; i < MSS_BANDS; ++i) mImageBandMSS[i].attach(NULL);
     }
-    void FreeAlignedMSS() {
-        //mAlignedMSS.attach(NULL);
-        mAlignedMSS.release();
-    }
     
     void WriteRRCedPAN() {
         OLOG("Writing RRC-ed PAN image as RAW file ...");
@@ -105,32 +190,19 @@ public:
     }
     
     void WriteRRCedPAN_TIFF(int lineOffset) {
-        GDALDriver * driverGeotiff = GetGDALDriverManager()->GetDriverByName("GTiff");
         auto saveFilePath = IMO::BuildOutputFilePath(mPanFile, RRC_STEM_EXT, TIFF_FILE_EXT);
-        
         int rows = (int)(mLinesPAN - lineOffset);
         int cols = PIXELS_PER_LINE;
-        // char ** options = CSLParseCommandLine("");
-        // options = CSLSetNameValue(options, "BIGTIFF", "YES"/*"IF_NEEDED"*/);
-        // GDALDataset * ds = driverGeotiff->Create(saveFilePath.c_str(), cols, rows, 1, GDT_UInt16, options);
-        // CSLDestroy(options);
         
-        OLOG("Writing RRC-ed PAN image as BIG TIFF file ...");
-        GDALDataset * ds = driverGeotiff->Create(saveFilePath.c_str(), cols, rows, 1, GDT_UInt16, NULL);
-        GDALRasterBand * bnd = ds->GetRasterBand(1);
-        stop_watch::rst();
-        if (bnd->RasterIO(GF_Write, 0, 0, cols, rows,
-                          mImagePAN.get() + lineOffset * PIXELS_PER_LINE * BYTES_PER_PIXEL,
-                          cols, rows, GDT_UInt16, 0, 0) == CE_Failure) {
-            throw std::runtime_error("GDAL::GDALRasterBand::RasterIO() failed.");
+        OLOG("Writing RRC-ed PAN image as TIFF file ...");
+        // strips are views of the loaded image, compressed & written while the next ones are queued
+        TiffWriter writer(saveFilePath, cols, rows, 1);
+        uint16_t * image = mImagePAN.get() + (size_t)lineOffset * PIXELS_PER_LINE;
+        for (int row = 0; row < rows; row += TIFF_WRITE_STRIP_ROWS) {
+            int n = std::min(TIFF_WRITE_STRIP_ROWS, rows - row);
+            writer.Write(cv::Mat(n, cols, CV_16UC1, image + (size_t)row * cols), row);
         }
-        GDALClose(ds);
-        auto es = stop_watch::tik().ellapsed;
-        OLOG("Written to file [%s].", saveFilePath.c_str());
-        OLOG("Written %s bytes in %s seconds (%s MBps).",
-             comma_sep((mLinesPAN - lineOffset) * PIXELS_PER_LINE * BYTES_PER_PIXEL).sep(),
-             comma_sep(es).sep(),
-             comma_sep(mSizePAN/es/1024.0/1024.0).sep());
+        writer.Close();
     }
     
     void WriteRRCedMSS() {
@@ -149,39 +221,14 @@ public:
         }
     }
     
-    void WriteAlignedMSS_RAW() {
-        OLOG("Writing aligned MSS image as RAW file ...");
-        
-        auto saveFilePath = IMO::BuildOutputFilePath(mMssFile, ".IBCOR");
-        stop_watch::rst();
-        //WriteBufferToFile((const char *)mAlignedMSS.get(), mSizeMSS, saveFilePath);
-        IMO::WriteBufferToFile((const char *)mAlignedMSS.data, mSizeMSS, saveFilePath);
-        auto es = stop_watch::tik().ellapsed;
-        
-        OLOG("Written to file [%s].", saveFilePath.c_str());
-        OLOG("Writing cost %s seconds (%s MBps).",
-             comma_sep(es).sep(),
-             comma_sep(mSizeMSS/es/1024.0/1024.0).sep());
-    }
-    
-    void WriteAlignedMSS_TIFF() {
-        OLOG("Writing aligned MSS image as TIFF file ...");
-        
+    /// aligned MSS TIFF of `rows' lines, strips are written by `DoInterBandAlignment()' as they are aligned
+    std::unique_ptr<TiffWriter> OpenAlignedMSS_TIFF(int rows) {
         auto saveFilePath = IMO::BuildOutputFilePath(mMssFile, IBPA_STEM_EXT, TIFF_FILE_EXT);
-        // cv::Mat imageData((int)mLinesMSS, PIXELS_PER_LINE, CV_16U, mAlignedMSS.get());
-        // cv::Mat imageData(rows, PIXELS_PER_LINE, CV_16U, mAlignedMSS.get());
-        cv::Mat & imageData = mAlignedMSS;
-        
-        stop_watch::rst();
-        if (!cv::imwrite(saveFilePath, imageData)) {
-            throw std::runtime_error("Writing/converting MSS image as TIFF failed");
-        }
-        auto es = stop_watch::tik().ellapsed;
-        
-        OLOG("Written to file [%s].", saveFilePath.c_str());
-        OLOG("Writing cost %s seconds (%s MBps).",
-             comma_sep(es).sep(),
-             comma_sep(imageData.elemSize()*imageData.total()/es/1024.0/1024.0).sep());
+        OLOG("Writing aligned MSS image as TIFF file [%s] ...", saveFilePath.c_str());
+        // band order & photometric of the former `cv::imwrite' output, which `stitch' reads back with `cv::imread'
+        TiffOptions options = TiffOptions::Global();
+        options.rgba = true;
+        return std::unique_ptr<TiffWriter>(new TiffWriter(saveFilePath, PIXELS_PER_MSSBAND, rows, MSS_BANDS, options));
     }
     
     // Relative radiation correction
@@ -190,7 +237,7 @@ public:
         
         mRRCParamPAN = IMO::LoadRRCParamFile(mRrcPanFile.c_str(), PIXELS_PER_LINE);
         
-        OLOG("Begin inplace RRC for PAN data ... ");
+        OLOG("Begin inplace RRC for PAN data with %d threads ... ", ThreadPool::Shared().Size());
         stop_watch::rst();
         IMO::InplaceRRC(mImagePAN.get(), PIXELS_PER_LINE, (int)mLinesPAN, mRRCParamPAN);
         auto es = stop_watch::tik().ellapsed;
@@ -204,26 +251,28 @@ public:
             if (mImageBandMSS[b].is_null()) throw std::logic_error("MSS raw image data not loaded, call `LoadMSS()' first");
         }
         
-        int rrcLinesMSS = PIXELS_PER_LINE / MSS_BANDS;
+        // all bands are split into row blocks and corrected concurrently
+        std::unique_ptr<RRCKernel> kernels[MSS_BANDS];
+        RRCJob jobs[MSS_BANDS];
+        BuildRRCKernels4MSS(kernels);
         for (int i = 0; i < MSS_BANDS; ++i) {
-            mRRCParamMSS[i] = ImageOperations::LoadRRCParamFile(mRrcMssBndFile[i].c_str(), rrcLinesMSS);
+            jobs[i] = { mImageBandMSS[i].get(), mLinesMSS, kernels[i].get() };
         }
         
-        for (int i = 0; i < MSS_BANDS; ++i) {
-            OLOG("Begin inplace RRC for MSS band %d ... ", i);
-            stop_watch::rst();
-            IMO::InplaceRRC(mImageBandMSS[i].get(), PIXELS_PER_LINE / MSS_BANDS, (int)mLinesMSS, mRRCParamMSS[i]);
-            auto es = stop_watch::tik().ellapsed;
-            OLOG("RRC done for MSS band %d in %s seconds (%s MBps).",
-                 i,
-                 comma_sep(es).sep(),
-                 comma_sep(mSizeMSS/MSS_BANDS/es/1024.0/1024.0).sep());
-        }
+        OLOG("Begin inplace RRC for %d MSS bands with %d threads ... ", MSS_BANDS, ThreadPool::Shared().Size());
+        stop_watch::rst();
+        RRCKernel::ApplyParallel(jobs, MSS_BANDS);
+        auto es = stop_watch::tik().ellapsed;
+        OLOG("RRC done for all MSS bands in %s seconds (%s MBps).",
+             comma_sep(es).sep(),
+             comma_sep(mSizeMSS/es/1024.0/1024.0).sep());
     }
     
     void CalcInterBandCorrelation(int slices = IBCV_DEF_SLICES,
                                   int sections = IBCV_DEF_SECTIONS,
                                   double threshold = IBCV_DEF_THRESHOLD,
+                                  IBCMode mode = IBC_MODE_PAN,
+                                  int minValid = 0,
                                   bool autoUnloadPAN = true) {
         if (slices < IBCV_MIN_SLICES) {
             throw std::invalid_argument(xs("CalcInterBandCorrelation: at lease %d slice needed", IBCV_MIN_SLICES).s);
@@ -236,96 +285,172 @@ public:
                                            "not enough total PAN data lines", CORRELATION_LINES).s);
         }
         
-        OLOG("Calculating inter-band correlation with %d slices in %d section(s) ...", slices, sections);
+        static const char * modeNames[] = { "PAN resolution", "MSS resolution", "PAN vs MSS resolution" };
+        OLOG("Calculating inter-band correlation at %s with %d slices in %d section(s) ...",
+             modeNames[mode], slices, sections);
         for (int b = 0; b < MSS_BANDS; ++b) {
             mBandShift[b] = new InterBandShift[slices * sections];
         }
 
-        double es = 0.0;
-        int baseRows = std::min((int)mLinesPAN, CORRELATION_LINES);
-        int baseRowGap = ((int)mLinesPAN - baseRows * sections) / (sections + 1);
+        int baseRows, baseRowGap;
+        CorrelationSectionRows(sections, baseRows, baseRowGap);
         int baseSliceCols = PIXELS_PER_LINE / slices;
         size_t sliceBytes = (size_t)baseRows * baseSliceCols * BYTES_PER_PIXEL;
-        nc::NdArray<uint16_t> baseImage16U(mImagePAN.get(), (int)mLinesPAN, PIXELS_PER_LINE, false);
+        int bandRows = baseRows / MSS_BANDS;
+        int bandRowGap = baseRowGap / MSS_BANDS;
+        int bandSliceCols = baseSliceCols / MSS_BANDS;
+
+        // correlation windows cropped (centered) to 2/3/5-smooth sizes, MSS windows are the PAN ones / MSS_BANDS
+        int winRows = baseRows, winCols = baseSliceCols, winRowOff = 0, winColOff = 0;
+        int bandWinRows = bandRows, bandWinCols = bandSliceCols;
+        if (RegistrationOptions::Global().smoothWindows) {
+            winRows = SmoothSize(baseRows, MSS_BANDS);
+            winCols = SmoothSize(baseSliceCols, MSS_BANDS);
+            winRowOff = (baseRows - winRows) / 2 / MSS_BANDS * MSS_BANDS;
+            winColOff = (baseSliceCols - winCols) / 2 / MSS_BANDS * MSS_BANDS;
+            bandWinRows = winRows / MSS_BANDS;
+            bandWinCols = winCols / MSS_BANDS;
+            OLOG("Correlation windows cropped to smooth sizes: %dx%d -> %dx%d (PAN), %dx%d (MSS).",
+                 baseSliceCols, baseRows, winCols, winRows, bandWinCols, bandWinRows);
+        }
+        // per-section rows: views of the loaded images, or the samples read by `LoadCorrelationSamples()'
+        std::vector<cv::Mat> baseSections(sections);
+        std::vector<cv::Mat> bandSections[MSS_BANDS];
+        bool loaded = !mImagePAN.is_null();
+        for (int b = 0; b < MSS_BANDS; ++b) loaded = loaded && !mImageBandMSS[b].is_null();
+        if (loaded) {
+            for (int sec = 0; sec < sections; ++sec) {
+                size_t secRowStart = baseRowGap + sec * (baseRows + baseRowGap);
+                size_t secBandRowStart = bandRowGap + sec * (bandRows + bandRowGap);
+                baseSections[sec] = cv::Mat(baseRows, PIXELS_PER_LINE, CV_16UC1,
+                                            mImagePAN.get() + secRowStart * PIXELS_PER_LINE);
+                for (int b = 0; b < MSS_BANDS; ++b) {
+                    bandSections[b].push_back(cv::Mat(bandRows, PIXELS_PER_LINE / MSS_BANDS, CV_16UC1,
+                                                      mImageBandMSS[b].get() + secBandRowStart * (PIXELS_PER_LINE / MSS_BANDS)));
+                }
+            }
+        } else if ((int)mSamplePAN.size() == sections) {
+            baseSections = mSamplePAN;
+            for (int b = 0; b < MSS_BANDS; ++b) bandSections[b] = mSampleMSS[b];
+        } else {
+            throw std::logic_error("PAN & MSS image data not loaded, call `LoadPAN()' & `LoadMSS()', "
+                                   "or `LoadCorrelationSamples()' with the same section count first");
+        }
 
-        for (int sec = 0; sec < sections; ++sec) {
-            OLOG(":::: #%d section processing ::::", sec + 1);
-            for (int i = 0; i < slices; ++i)
-            {
-                OLOG("Extracting #%d slice from PAN image as base slice ...", i);
-                stop_watch::rst();
-                int secRowStart = baseRowGap + sec * (baseRows + baseRowGap);
-                auto baseSlice16U = baseImage16U(nc::Slice(secRowStart, secRowStart + baseRows),
-                                                 nc::Slice(i * baseSliceCols, (i + 1) * baseSliceCols));
-                es = stop_watch::tik().ellapsed;
-                OLOG("Extraction done in %s seconds (%s MBps).",
-                     comma_sep(es).sep(),
-                     comma_sep(sliceBytes/es/1024.0/1024.0).sep());
+        // MSS mode results, only kept for comparison
+        std::vector<InterBandShift> mssShift(mode == IBC_MODE_COMPARE ? MSS_BANDS * slices * sections : 0);
+        double modeTime[2] = { 0.0, 0.0 };
+        std::mutex timeLock;
 
-                stop_watch::rst();
-                auto baseSlice32F = baseSlice16U.astype<float>();
-                es = stop_watch::tik().ellapsed;
-                OLOG("Converting base slice from Uint16 to Float32 elements in %s seconds (%s MBps).",
-                     comma_sep(es).sep(),
-                     comma_sep(sliceBytes/es/1024.0/1024.0).sep());
+        // every (section, slice) is an independent task with its own scratch images, the base slice
+        // spectrum is computed once and reused for all bands; results go to fixed slots of `mBandShift',
+        // so they don't depend on thread count or order
+        int tasks = sections * slices;
+        OLOG("Running %d correlation tasks with %d threads ...", tasks, ThreadPool::Shared().Size());
+        stop_watch sw;
+        auto runTask = [&](int t, int worker) {
+            int i = t % slices;
+            int sec = t / slices;
 
-                cv::Mat baseMat32F(baseRows, baseSliceCols, CV_32FC1, baseSlice32F.data());
-                
-                int bandRows = baseRows / MSS_BANDS;
-                int bandRowGap = baseRowGap / MSS_BANDS;
-                int bandSliceCols = baseSliceCols / MSS_BANDS;
-                size_t bandSliceBytes = sliceBytes / (MSS_BANDS * MSS_BANDS);
-                for (int b = 0; b < MSS_BANDS; ++b) {
-                    OLOG("Calculating inter-band correlation of BAND%d ...", b);
-                    nc::NdArray<uint16_t> band16U(mImageBandMSS[b].get(), (int)mLinesMSS, PIXELS_PER_LINE / MSS_BANDS, false);
-                    
-                    OLOG("Extracting #%d slice from #%d band of MSS image ...", i, b);
-                    stop_watch::rst();
-                    int secBandRowStart = bandRowGap + sec * (bandRows + bandRowGap);
-                    auto bandSlice16U = band16U(nc::Slice(secBandRowStart, secBandRowStart + bandRows),
-                                                nc::Slice(i * bandSliceCols, (i + 1) * bandSliceCols));
-                    es = stop_watch::tik().ellapsed;
-                    OLOG("Extraction done in %s seconds (%s MBps).",
-                         comma_sep(es).sep(),
-                         comma_sep(bandSliceBytes/es/1024.0/1024.0).sep());
+            // uint16 ROIs go straight into DFT buffers, float copies are only made for resizing
+            cv::Mat baseSlice32F;
+            cv::Mat bandSlice32F;
+            cv::Mat scaledSlice32F;
+            auto correlate = [&](bool atMSS, InterBandShift * shifts[MSS_BANDS]) {
+                stop_watch tsw;
+                cv::Mat base = baseSections[sec](cv::Rect(i * baseSliceCols + winColOff, winRowOff, winCols, winRows));
+                if (atMSS) {
+                    // area averaging puts MSS pixel centers exactly where upscaling takes them from
+                    PixelOps::U16ToF32Padded(base, baseSlice32F, base.rows, base.cols);
+                    cv::resize(baseSlice32F, scaledSlice32F, cv::Size(bandWinCols, bandWinRows), 0, 0, cv::INTER_AREA);
+                    base = scaledSlice32F;
+                }
+                PyramidRegistrar registrar(base);
+                auto baseTime = tsw.tick().ellapsed;
+                double total = baseTime;
 
-                    stop_watch::rst();
-                    auto bandSlice32F = bandSlice16U.astype<float>();
-                    es = stop_watch::tik().ellapsed;
-                    OLOG("Converting base slice from Uint16 to Float32 elements in %s seconds (%s MBps).",
-                         comma_sep(es).sep(),
-                         comma_sep(bandSliceBytes/es/1024.0/1024.0).sep());
-                    
-                    OLOG("Upscaling slice of MSS band image to the size of base slice image ...");
-                    cv::Mat scaledBandSlice32F;
-                    stop_watch::rst();
-                    cv::resize(cv::Mat(bandRows, bandSliceCols, CV_32FC1, bandSlice32F.data())
-                               , scaledBandSlice32F
-                               , cv::Size(baseSliceCols, baseRows)
-                               , 0
-                               , 0
-                               , cv::INTER_CUBIC);
-                    es = stop_watch::tik().ellapsed;
-                    OLOG("Upscaling done in %s seconds (%s MBps).",
-                         comma_sep(es).sep(),
-                         comma_sep(bandSliceBytes/es/1024.0/1024.0).sep());
+                for (int b = 0; b < MSS_BANDS; ++b) {
+                    cv::Mat band = bandSections[b][sec](cv::Rect(i * bandSliceCols + winColOff / MSS_BANDS,
+                                                                 winRowOff / MSS_BANDS,
+                                                                 bandWinCols, bandWinRows));
+                    if (!atMSS) {
+                        PixelOps::U16ToF32Padded(band, bandSlice32F, band.rows, band.cols);
+                        cv::resize(bandSlice32F
+                                   , scaledSlice32F
+                                   , cv::Size(winCols, winRows)
+                                   , 0
+                                   , 0
+                                   , WarpOptions::CvInterpolation(WarpOptions::Global().quality));
+                        band = scaledSlice32F;
+                    }
+                    auto prepTime = tsw.tick().ellapsed;
 
-                    OLOG("Calculating phase correlation of slice #%d for band #%d ...", i, b);
                     double res = 0.0;
-                    stop_watch::rst();
-                    cv::Point2d rv = cv::phaseCorrelate(baseMat32F, scaledBandSlice32F, cv::noArray(), &res);
-                    es = stop_watch::tik().ellapsed;
-                    OLOG("Calculating done in %s seconds (%s MBps).",
-                         comma_sep(es).sep(),
-                         comma_sep(sliceBytes/es/1024.0/1024.0).sep());
-                    
-                    InterBandShift & shift = mBandShift[b][sec * slices + i];
-                    shift.dx = rv.x;
-                    shift.dy = rv.y;
+                    cv::Point2d rv = registrar.Register(band, &res);
+                    auto corrTime = tsw.tick().ellapsed;
+                    total += prepTime + corrTime;
+
+                    // shifts found at MSS resolution are rescaled to PAN pixels
+                    double scale = atMSS ? MSS_BANDS : 1.0;
+                    InterBandShift & shift = *shifts[b];
+                    shift.dx = rv.x * scale;
+                    shift.dy = rv.y * scale;
                     shift.rs = res;
                     shift.cx = i * baseSliceCols + baseSliceCols / 2;
+                    OLOG("[T%02d] section #%d slice #%d band #%d (%s): base spectrum %s, band prepared %s, correlated %s seconds.",
+                         worker, sec + 1, i, b, atMSS ? "MSS" : "PAN",
+                         comma_sep(b == 0 ? baseTime : 0.0).sep(),
+                         comma_sep(prepTime).sep(),
+                         comma_sep(corrTime).sep());
+                }
+                std::lock_guard<std::mutex> lock(timeLock);
+                modeTime[atMSS ? 1 : 0] += total;
+            };
+
+            InterBandShift * shifts[MSS_BANDS];
+            for (int b = 0; b < MSS_BANDS; ++b) shifts[b] = &mBandShift[b][sec * slices + i];
+            correlate(mode == IBC_MODE_MSS, shifts);
+            if (mode == IBC_MODE_COMPARE) {
+                for (int b = 0; b < MSS_BANDS; ++b) shifts[b] = &mssShift[(b * sections + sec) * slices + i];
+                correlate(true, shifts);
+            }
+        };
+        
+        if (minValid <= 0) {
+            ThreadPool::Shared().ParallelFor(tasks, runTask);
+        } else {
+            // most textured windows first, one thread pool round at a time, until every band has
+            // `minValid' results above threshold; windows never correlated stay rejected (rs = 0)
+            std::vector<int> order = RankCorrelationWindows(baseSections, slices, baseSliceCols,
+                                                            cv::Rect(winColOff, winRowOff, winCols, winRows));
+            for (int b = 0; b < MSS_BANDS; ++b) {
+                for (int t = 0; t < tasks; ++t) {
+                    int cx = (t % slices) * baseSliceCols + baseSliceCols / 2;
+                    mBandShift[b][t] = { NAN, NAN, 0.0, cx };
+                    if (mode == IBC_MODE_COMPARE) mssShift[b * tasks + t] = { NAN, NAN, 0.0, cx };
                 }
             }
+            int round = std::max(ThreadPool::Shared().Size(), 1);
+            int done = 0, fewest = 0;
+            while (done < (int)order.size() && fewest < minValid) {
+                int n = std::min(round, (int)order.size() - done);
+                ThreadPool::Shared().ParallelFor(n, [&](int k, int worker) { runTask(order[done + k], worker); });
+                done += n;
+                fewest = tasks;
+                for (int b = 0; b < MSS_BANDS; ++b) {
+                    int valid = 0;
+                    for (int t = 0; t < tasks; ++t) valid += mBandShift[b][t].rs >= threshold;
+                    fewest = std::min(fewest, valid);
+                }
+            }
+            OLOG("Texture-ranked correlation: %d of %d windows correlated, %d of %d valid results at least per band.",
+                 done, tasks, fewest, minValid);
+        }
+        auto es = sw.tick().ellapsed;
+        OLOG("%d correlation tasks done in %s seconds.", tasks, comma_sep(es).sep());
+        FFTWorkspaceCache::Clear();
+        if (mode == IBC_MODE_COMPARE) {
+            ReportCorrelationModeAccuracy(mssShift.data(), slices, sections, threshold, modeTime);
         }
         
         OLOG("Inter-band correlation finished, result:");
@@ -342,79 +467,169 @@ public:
         if (autoUnloadPAN) {
             OLOG("Unloading PAN raw image data ...");
             UnloadPAN();
+            UnloadCorrelationSamples();
             OLOG("Unloaded.");
         }
     }
     
-    // opencv::remap does not support image data larger than 32767*32767
-    // processing portion by portion of input image for now.
+    /// fingerprint of the inputs & every option `CalcInterBandCorrelation()' results depend on
+    std::string InterBandCacheKey(int slices, int sections, double threshold, IBCMode mode, int minValid,
+                                  bool rrc4PAN, bool rrc4MSS) const {
+        Fingerprint fp;
+        fp.Add(PCACHE_KIND_IBCOR).AddFile(mPanFile).AddFile(mMssFile);
+        fp.Add(rrc4PAN).Add(rrc4MSS);
+        if (rrc4PAN) fp.AddFile(mRrcPanFile);
+        for (int b = 0; rrc4MSS && b < MSS_BANDS; ++b) fp.AddFile(mRrcMssBndFile[b]);
+        if (rrc4PAN || rrc4MSS) fp.Add(RRCOptions::Global().engine).Add(RRCOptions::Global().bits);
+        
+        const RegistrationOptions & ro = RegistrationOptions::Global();
+        fp.Add(slices).Add(sections).Add(threshold).Add(mode).Add(minValid);
+        fp.Add(ro.levels).Add(ro.refineRows).Add(ro.refineCols).Add(ro.smoothWindows);
+        fp.Add(WarpOptions::Global().quality);  // interpolation of MSS upscaling
+        return fp.Hex();
+    }
+    
+    /// shift tables (`shifts.B<n>': dx, dy, rs, cx per slice) & fitted coefficients into `record'
+    void ExportInterBandParams(ParamRecord & record, int slices, int sections) const {
+        record.Set("slices", slices);
+        record.Set("sections", sections);
+        for (int b = 0; b < MSS_BANDS; ++b) {
+            std::vector<double> shifts;
+            for (int i = 0; !mBandShift[b].is_null() && i < slices * sections; ++i) {
+                const InterBandShift & ibs = mBandShift[b][i];
+                shifts.insert(shifts.end(), { ibs.dx, ibs.dy, ibs.rs, (double)ibs.cx });
+            }
+            record.Set(xs("shifts.B%d", b).s, shifts);
+            record.Set(xs("coeffs.dx.B%d", b).s, std::vector<double>(mDeltaXcoeffs[b], mDeltaXcoeffs[b] + 2));
+            record.Set(xs("coeffs.dy.B%d", b).s, std::vector<double>(mDeltaYcoeffs[b], mDeltaYcoeffs[b] + 3));
+        }
+    }
+    
+    /// restore results of `CalcInterBandCorrelation()' from `record', shift tables are only
+    /// restored if recorded with the same slice & section counts (i.e. not for other scenes)
+    void ImportInterBandParams(const ParamRecord & record, int slices, int sections) {
+        bool sameLayout = record.Has("slices") && record.Get("slices", 1)[0] == slices
+                       && record.Has("sections") && record.Get("sections", 1)[0] == sections;
+        for (int b = 0; b < MSS_BANDS; ++b) {
+            auto & dx = record.Get(xs("coeffs.dx.B%d", b).s, 2);
+            auto & dy = record.Get(xs("coeffs.dy.B%d", b).s, 3);
+            std::copy(dx.begin(), dx.end(), mDeltaXcoeffs[b]);
+            std::copy(dy.begin(), dy.end(), mDeltaYcoeffs[b]);
+            
+            std::string name = xs("shifts.B%d", b).s;
+            if (!sameLayout || !record.Has(name) || record.Get(name).size() != (size_t)slices * sections * 4) continue;
+            auto & shifts = record.Get(name);
+            mBandShift[b] = new InterBandShift[slices * sections];
+            for (int i = 0; i < slices * sections; ++i) {
+                mBandShift[b][i] = { shifts[i * 4], shifts[i * 4 + 1], shifts[i * 4 + 2], (int)shifts[i * 4 + 3] };
+            }
+        }
+        if (sameLayout && !mBandShift[0].is_null()) DumpInterBandShiftValues(slices, sections);
+        for (int b = 0; b < MSS_BANDS; ++b) {
+            OLOG("BAND %d deltaX coeff: [1] %.15f, [0] %.9f", b, mDeltaXcoeffs[b][1], mDeltaXcoeffs[b][0]);
+            OLOG("BAND %d deltaY coeff: [2] %.15f, [1] %.15f, [0] %.9f",
+                 b, mDeltaYcoeffs[b][2], mDeltaYcoeffs[b][1], mDeltaYcoeffs[b][0]);
+        }
+    }
+    
+    /// write fitted inter-band coefficients as text, one band per line: `band dx[1] dx[0] dy[2] dy[1] dy[0]',
+    /// `<MSS stem>.IBCOEF.txt' in current directory if `filePath' is empty; returns path written
+    std::string WriteCorrelationCoefficients(const std::string & filePath = "") const {
+        auto saveFilePath = filePath.length() > 0 ? filePath : IMO::BuildOutputFilePath(mMssFile, IBCOEF_STEM_EXT, ".txt");
+        scoped_ptr<FILE, FileDtor> f = fopen(saveFilePath.c_str(), "w");
+        if (f.is_null()) throw errno_error(xs("open file [%s] failed", saveFilePath.c_str()).s);
+        
+        fprintf(f, "# band dx[1] dx[0] dy[2] dy[1] dy[0], shift(cx) = sum(c[n] * cx^n), cx in PAN pixels\n");
+        for (int b = 0; b < MSS_BANDS; ++b) {
+            fprintf(f, "%d %.17g %.17g %.17g %.17g %.17g\n", b,
+                    mDeltaXcoeffs[b][1], mDeltaXcoeffs[b][0],
+                    mDeltaYcoeffs[b][2], mDeltaYcoeffs[b][1], mDeltaYcoeffs[b][0]);
+        }
+        if (ferror(f)) throw errno_error(xs("write file [%s] failed", saveFilePath.c_str()).s);
+        OLOG("Inter-band coefficients written to file [%s].", saveFilePath.c_str());
+        return saveFilePath;
+    }
+    
+    // opencv::remap does not support image data larger than 32767*32767, the remap engine processes
+    // portion by portion of input image; the analytic engine has no row limit and aligns the whole
+    // strip in one pass of `linePerSection' row stripes, without overlapped lines (see `AlignStrip()').
+    // aligned image starts `sectionOverlap' lines after `lineOffset' unless `keepLeadingLines', both engines.
     void DoInterBandAlignment(int linePerSection, int lineOffset = 0,
                               int sectionOverlap = IBPA_DEFAULT_LINEOVERLAP,
                               bool keepLeadingLines = false,
                               bool autoUnloadRawMSS = true) {
+        bool analytic = WarpOptions::Global().engine == WARP_ENGINE_ANALYTIC;
         if (sectionOverlap > IBPA_MAX_LINEOVERLAP) {
             throw std::invalid_argument(xs("Overlap value %d exceeds maximum allowed value(%d)"
                                            , sectionOverlap, IBPA_MAX_LINEOVERLAP).s);
         }
-        if (linePerSection > 32767) {
+        if (!analytic && linePerSection > 32767) {
             throw std::invalid_argument("Row number exceeds OpenCV allowed value");
         }
-        if (linePerSection < sectionOverlap * 2) {
+        if (!analytic && linePerSection < sectionOverlap * 2) {
             throw std::invalid_argument("Lines per section too small or section overlapped lines too large");
         }
+        if (analytic && linePerSection <= 0) {
+            throw std::invalid_argument("Lines per section should be positive");
+        }
         if (mLinesMSS - lineOffset < IBPA_MIN_PROCESSLINES) {
             throw std::invalid_argument("Too few image lines left to process");
         }
         
-        OLOG("Doing inter-band alignment ...");
+        WarpInterp quality = WarpOptions::Global().quality;
+        OLOG("Doing inter-band alignment (%s engine, %s) ...",
+             WarpOptions::EngineName(WarpOptions::Global().engine), WarpOptions::QualityName(quality));
+        // warp tables / remap map chunks only depend on the coefficients, shared by all sections
+        for (int b = 0; b < MSS_BANDS; ++b) {
+            ColumnShift model = ColumnShift::FromPolynomial(PIXELS_PER_MSSBAND, mDeltaXcoeffs[b], mDeltaYcoeffs[b], MSS_BANDS);
+            if (WarpOptions::Global().engine == WARP_ENGINE_ANALYTIC) {
+                mBandWarp[b].reset(new ColumnShiftWarp(model, quality));
+            } else {
+                mBandRemap[b].reset(new ColumnShiftRemap(model, quality));
+            }
+        }
         
+        // aligned image is never held as a whole: strips go to the writer thread as soon as they are aligned
+        auto writer = OpenAlignedMSS_TIFF((int)(mLinesMSS - lineOffset - (keepLeadingLines ? 0 : sectionOverlap)));
         size_t bytes = 0;
-        size_t offset = lineOffset;
-        int processedLines = 0;
-        int sections = (int)((mLinesMSS - lineOffset) / (linePerSection - sectionOverlap)) + 1;
-        mAlignedMSS.create((int)(mLinesMSS - lineOffset - (keepLeadingLines ? 0 : sectionOverlap)),
-                           PIXELS_PER_MSSBAND, CV_16UC4);
         stop_watch sw;
         
-        for (int i = 0; ; ++i) {
-            auto lines = std::min(mLinesMSS - offset, (size_t)linePerSection);
-            if (mLinesMSS < offset || lines < IBPA_MIN_PROCESSLINES) break;
-            
-            OLOG("[SEC%d] %s lines for processing [offset=%s]."
-                 , i+1
-                 , comma_sep(lines).sep()
-                 , comma_sep(offset).sep());
-            
-            
-            OLOG("Doing inter-band alignment of section %d/%d ...", i+1, sections);
-            cv::Mat sectionMat = DoInterBandAlignment(offset, (int)lines);
-            OLOG("Copying to final image ...");
-            if (i == 0 && keepLeadingLines) {
-                memcpy(mAlignedMSS.ptr(0),
-                       sectionMat.ptr(0),
-                       (size_t)sectionOverlap * PIXELS_PER_MSSBAND * sectionMat.elemSize());
-                processedLines += sectionOverlap;
-                OLOG("Leading lines copied.");
+        if (analytic) {
+            bytes = AlignStrip(lineOffset + (keepLeadingLines ? 0 : sectionOverlap), linePerSection, *writer);
+        } else {
+            size_t offset = lineOffset;
+            int processedLines = 0;
+            int sections = (int)((mLinesMSS - lineOffset) / (linePerSection - sectionOverlap)) + 1;
+            for (int i = 0; ; ++i) {
+                auto lines = std::min(mLinesMSS - offset, (size_t)linePerSection);
+                if (mLinesMSS < offset || lines < IBPA_MIN_PROCESSLINES) break;
+                
+                OLOG("[SEC%d] %s lines for processing [offset=%s]."
+                     , i+1
+                     , comma_sep(lines).sep()
+                     , comma_sep(offset).sep());
+                
+                // leading overlapped lines are only kept for the first section, the other sections' ones
+                // were written by the previous section already
+                int skipLines = i == 0 && keepLeadingLines ? 0 : sectionOverlap;
+                OLOG("Doing inter-band alignment of section %d/%d ...", i+1, sections);
+                cv::Mat aligned((int)lines - skipLines, PIXELS_PER_MSSBAND, CV_16UC4);
+                AlignSection(offset, (int)lines, skipLines, aligned);
+                writer->Write(aligned, processedLines);
+                OLOG("Section aligned.");
+                
+                processedLines += lines - skipLines;
+                bytes += (size_t)lines * PIXELS_PER_MSSBAND * BYTES_PER_PIXEL;
+                offset += linePerSection - sectionOverlap;
             }
-            
-            memcpy(mAlignedMSS.ptr(processedLines),
-                   sectionMat.ptr(sectionOverlap),
-                   (size_t)(lines - sectionOverlap) * PIXELS_PER_MSSBAND * sectionMat.elemSize());
-            OLOG("Copied.");
-            
-            processedLines += lines - sectionOverlap;
-            bytes += (size_t)lines * PIXELS_PER_MSSBAND * BYTES_PER_PIXEL;
-            offset += linePerSection - sectionOverlap;
         }
         
+        OLOG("Flushing aligned TIFF image ...");
+        writer->Close();
         auto es = sw.tick().ellapsed;
-        OLOG("Alignment done in %s seconds (%s MBps).",
+        OLOG("Alignment & output done in %s seconds (%s MBps).",
              comma_sep(es).sep(),
              comma_sep(bytes/es/1024.0/1024.0).sep());
-        
-        OLOG("Outputing aligned TIFF image ...");
-        WriteAlignedMSS_TIFF();
-        OLOG("Output done.");
 
         if (autoUnloadRawMSS) {
             OLOG("Unloading MSS (unaligned & band-split) raw image data ...");
@@ -425,46 +640,120 @@ public:
     }
     
 protected:
-    cv::Mat DoInterBandAlignment(size_t rowOffset, int rows) {
-        cv::Mat alignedBands[MSS_BANDS];
-        scoped_ptr<float> mapX = new float[PIXELS_PER_MSSBAND * rows];
-        scoped_ptr<float> mapY = new float[PIXELS_PER_MSSBAND * rows];
-        
-        for (int b = 0; b < MSS_BANDS; ++b) {
-            double * coeffX = mDeltaXcoeffs[b];
-            double * coeffY = mDeltaYcoeffs[b];
-            
-            OLOG("[BAND#%d] creating mapX & mapY matrix ...", b);
-            // (x, y) -> coordinates of MSS BAND sized image
-            // polynomial coeffective values are of PAN size image
-            // take (x', y') for coordinates of PAN, then x' = 4x, y' = 4y when BANDS=4
-            // mapX(x,y) = mapX'(x',y')/4, mapY(x,y) = mapY'(x',y')/4
-            // for (size_t y = 0; y < mLinesMSS; ++y) {
-            for (size_t y = 0; y < rows; ++y) {
-                for (int x = 0; x < PIXELS_PER_MSSBAND; ++x) {
-                    auto yy = y * MSS_BANDS;
-                    auto xx = x * MSS_BANDS;
-                    mapX[y * PIXELS_PER_MSSBAND + x] = (float)((coeffX[1] * xx + coeffX[0] + xx)/MSS_BANDS);
-                    mapY[y * PIXELS_PER_MSSBAND + x] = (float)((coeffY[2] * xx * xx + coeffY[1] * xx + coeffY[0] + yy)/MSS_BANDS);
-                }
+    /// analytic engine: aligned rows of band rows [firstLine, mLinesMSS) to `writer' in a single pass of
+    /// `stripeRows' output row stripes. each stripe only reads the rolling source window its bicubic neighbourhoods
+    /// reach (as far as the largest vertical band shift), so every output row is computed exactly once and only
+    /// the top & bottom of the whole strip see the image border. returns bytes of band rows read.
+    size_t AlignStrip(size_t firstLine, int stripeRows, TiffWriter & writer) {
+        size_t bytes = 0;
+        int stripes = (int)((mLinesMSS - firstLine + stripeRows - 1) / stripeRows);
+        for (int i = 0; i < stripes; ++i) {
+            int y0 = (int)(firstLine + (size_t)i * stripeRows);
+            int y1 = (int)std::min(mLinesMSS, (size_t)y0 + stripeRows);
+            int s[MSS_BANDS], e[MSS_BANDS];
+            for (int b = 0; b < MSS_BANDS; ++b) {
+                mBandWarp[b]->SourceWindow(y0, y1, (int)mLinesMSS, s[b], e[b]);
+                bytes += (size_t)(e[b] - s[b]) * PIXELS_PER_MSSBAND * BYTES_PER_PIXEL;
             }
+            OLOG("[STRIPE%d/%d] aligning lines [%s, %s) ...", i+1, stripes, comma_sep(y0).sep(), comma_sep(y1).sep());
             
-            OLOG("[BAND#%d] remapping band image ...", b);
-            cv::remap(cv::Mat(rows, PIXELS_PER_MSSBAND, CV_16U, mImageBandMSS[b].get() + rowOffset * PIXELS_PER_MSSBAND),
-                      alignedBands[b],
-                      cv::Mat(rows, PIXELS_PER_MSSBAND, CV_32FC1, mapX),
-                      cv::Mat(rows, PIXELS_PER_MSSBAND, CV_32FC1, mapY),
-                      cv::INTER_CUBIC, cv::BORDER_CONSTANT);
-
-            OLOG("[BAND#%d] band remapping done.", b);
+            // (row block, band) tasks, each band writes its own channel of the interleaved stripe
+            cv::Mat stripe(y1 - y0, PIXELS_PER_MSSBAND, CV_16UC4);
+            uint16_t * out = (uint16_t *)stripe.data;
+            size_t outStride = stripe.step[0] / sizeof(uint16_t);
+            int blocks = (y1 - y0 + WARP_BLOCK_ROWS - 1) / WARP_BLOCK_ROWS;
+            ThreadPool::Shared().ParallelFor(blocks * MSS_BANDS, [&](int t, int) {
+                int b = t % MSS_BANDS;
+                int r0 = y0 + t / MSS_BANDS * WARP_BLOCK_ROWS, r1 = std::min(y1, r0 + WARP_BLOCK_ROWS);
+                mBandWarp[b]->Apply(mImageBandMSS[b].get() + (size_t)s[b] * PIXELS_PER_MSSBAND, PIXELS_PER_MSSBAND,
+                                    e[b] - s[b], PIXELS_PER_MSSBAND,
+                                    out + (size_t)(r0 - y0) * outStride + b, outStride, MSS_BANDS, r0 - s[b], r1 - s[b]);
+            });
+            writer.Write(stripe, (int)(y0 - firstLine));
         }
+        return bytes;
+    }
+    
+    /// remap engine: align section rows [rowOffset, rowOffset + rows) of all bands concurrently, output rows from
+    /// `skipRows' on are copied into the band channels of `dst' (CV_16UC4, `rows - skipRows' rows)
+    void AlignSection(size_t rowOffset, int rows, int skipRows, cv::Mat dst) {
+        // cv::remap only writes single-channel images: remap each band, then copy it into its channel
+        ThreadPool::Shared().ParallelFor(MSS_BANDS, [&](int b, int) {
+            cv::Mat aligned;
+            mBandRemap[b]->Apply(cv::Mat(rows, PIXELS_PER_MSSBAND, CV_16U, mImageBandMSS[b].get() + rowOffset * PIXELS_PER_MSSBAND),
+                                 aligned);
+            cv::Mat part = aligned.rowRange(skipRows, rows);
+            const int fromTo[] = { 0, b };
+            cv::mixChannels(&part, 1, &dst, 1, fromTo, 1);
+        });
+    }
+    
+    /// (section, slice) task indices ordered for texture-ranked correlation: by gradient energy of the PAN
+    /// window (every 4th row), round by round, each round takes the next best section of every slice column
+    /// (best columns first) so that accepted results spread across the line; flat windows (energy 0) are dropped
+    std::vector<int> RankCorrelationWindows(const std::vector<cv::Mat> & baseSections, int slices, int sliceCols,
+                                            const cv::Rect & window) const {
+        int sections = (int)baseSections.size();
+        std::vector<double> energy(sections * slices);
+        stop_watch sw;
+        ThreadPool::Shared().ParallelFor(sections * slices, [&](int t, int) {
+            int i = t % slices, sec = t / slices;
+            cv::Mat roi = baseSections[sec](cv::Rect(i * sliceCols + window.x, window.y, window.width, window.height));
+            energy[t] = PixelOps::GradientEnergy(roi, 4);
+        });
         
-        OLOG("Merging all image bands into a single multi-channel image ...");
-        cv::Mat rMat;
-        cv::merge(alignedBands, MSS_BANDS, rMat);
-        OLOG("Merged.");
-        
-        return rMat;
+        std::vector<std::vector<int>> columns(slices);
+        for (int i = 0; i < slices; ++i) {
+            for (int sec = 0; sec < sections; ++sec) {
+                if (energy[sec * slices + i] > 0.0) columns[i].push_back(sec * slices + i);
+            }
+            std::sort(columns[i].begin(), columns[i].end(), [&](int a, int b) { return energy[a] > energy[b]; });
+        }
+        std::vector<int> order;
+        for (int r = 0; r < sections; ++r) {
+            std::vector<int> round;
+            for (int i = 0; i < slices; ++i) {
+                if (r < (int)columns[i].size()) round.push_back(columns[i][r]);
+            }
+            std::sort(round.begin(), round.end(), [&](int a, int b) { return energy[a] > energy[b]; });
+            order.insert(order.end(), round.begin(), round.end());
+        }
+        OLOG("Texture of %d correlation windows measured in %s seconds, %d flat window(s) dropped.",
+             sections * slices, comma_sep(sw.tick().ellapsed).sep(), sections * slices - (int)order.size());
+        return order;
+    }
+    
+    /// deviation of MSS resolution results from PAN resolution results (in `mBandShift'),
+    /// over slices valid in both modes
+    void ReportCorrelationModeAccuracy(const InterBandShift * mssShift,
+                                       int slices, int sections, double threshold,
+                                       const double modeTime[2]) {
+        OLOG("Inter-band correlation accuracy, MSS resolution vs PAN resolution (PAN pixels):");
+        for (int b = 0; b < MSS_BANDS; ++b) {
+            int valid = 0, rejected = 0;
+            double sumX = 0.0, sumY = 0.0, maxX = 0.0, maxY = 0.0, sumR = 0.0;
+            for (int k = 0; k < slices * sections; ++k) {
+                const InterBandShift & p = mBandShift[b][k];
+                const InterBandShift & m = mssShift[b * slices * sections + k];
+                if (p.rs < threshold) continue;
+                if (m.rs < threshold) { rejected++; continue; }
+                double ex = fabs(m.dx - p.dx), ey = fabs(m.dy - p.dy);
+                sumX += ex; sumY += ey; sumR += m.rs / p.rs;
+                maxX = std::max(maxX, ex); maxY = std::max(maxY, ey);
+                valid++;
+            }
+            if (valid == 0) {
+                OLOG("\tBAND%d: no slice valid in both modes (%d rejected by MSS mode only).", b, rejected);
+                continue;
+            }
+            OLOG("\tBAND%d: %d slice(s), |ddx| mean %.4f max %.4f, |ddy| mean %.4f max %.4f, "
+                 "response ratio %.3f, %d rejected by MSS mode only.",
+                 b, valid, sumX / valid, maxX, sumY / valid, maxY, sumR / valid, rejected);
+        }
+        OLOG("Correlation busy time: PAN resolution %s, MSS resolution %s seconds (%.1fx).",
+             comma_sep(modeTime[0]).sep(),
+             comma_sep(modeTime[1]).sep(),
+             modeTime[0] / std::max(modeTime[1], 1e-9));
     }
     
     void DumpInterBandShiftValues(int slices, int sections) {
@@ -571,6 +860,114 @@ protected:
         OLOG("CheckFilesAttributes(): OK.");
     }
     
+private:
+    /// `rows' PAN lines per correlation section, `gap' lines before each section and after the last
+    void CorrelationSectionRows(int sections, int & rows, int & gap) const {
+        rows = std::min((int)mLinesPAN, CORRELATION_LINES);
+        gap = ((int)mLinesPAN - rows * sections) / (sections + 1);
+    }
+    
+    void BuildRRCKernels4MSS(std::unique_ptr<RRCKernel> kernels[MSS_BANDS]) {
+        int rrcLinesMSS = PIXELS_PER_LINE / MSS_BANDS;
+        for (int i = 0; i < MSS_BANDS; ++i) {
+            mRRCParamMSS[i] = ImageOperations::LoadRRCParamFile(mRrcMssBndFile[i].c_str(), rrcLinesMSS);
+            kernels[i].reset(new RRCKernel(mRRCParamMSS[i], rrcLinesMSS));
+        }
+    }
+    
+    /// a reader thread fills blocks of interleaved lines, each block is split (and corrected
+    /// if `kernels' given) into the band planes by rows on the shared thread pool
+    void SplitMSS(const RRCKernel * const * kernels, int blockLines) {
+        if (blockLines <= 0) throw std::invalid_argument("SplitMSS(): block lines should be a positive integer");
+        int bandBytesPerLine = PIXELS_PER_LINE * BYTES_PER_PIXEL / MSS_BANDS;
+        int bandPixelsPerLine = PIXELS_PER_LINE / MSS_BANDS; // MSS_BANDS: should always divisible by PIXELS_PER_LINE
+        for (int i = 0; i < MSS_BANDS; ++i) {
+            mImageBandMSS[i].attach(new uint16_t[mSizeMSS / MSS_BANDS]); // obsolte: `+1' for in case of indivisible
+        }
+        
+        scoped_ptr<FILE, FileDtor> f = fopen(mMssFile.c_str(), "rb");
+        if (f.is_null()) throw errno_error(xs("open MSS raw image file [%s] failed", mMssFile.c_str()).s);
+        
+        struct Block {
+            uint16_t * data;
+            size_t line;
+            size_t lines;
+        };
+        std::unique_ptr<uint16_t[]> buffers[RRC_STREAM_BUFFERS];
+        BoundedQueue<Block> freeBlocks(RRC_STREAM_BUFFERS);
+        BoundedQueue<Block> readBlocks(RRC_STREAM_BUFFERS);
+        for (int i = 0; i < RRC_STREAM_BUFFERS; ++i) {
+            buffers[i].reset(new uint16_t[(size_t)blockLines * PIXELS_PER_LINE]);
+            freeBlocks.Push({ buffers[i].get(), 0, 0 });
+        }
+        
+        std::exception_ptr readError;
+        RRCVerifyStats verified;
+        std::mutex verifyLock;
+        double readTime = 0.0, splitTime = 0.0;
+        stop_watch sw;
+        std::thread reader([&]() {
+            try {
+                Block blk;
+                for (size_t done = 0; done < mLinesMSS && freeBlocks.Pop(blk); done += blk.lines) {
+                    blk.line = done;
+                    blk.lines = std::min((size_t)blockLines, mLinesMSS - done);
+                    stop_watch rsw;
+                    if (fread(blk.data, PIXELS_PER_LINE * BYTES_PER_PIXEL, blk.lines, f) != blk.lines) {
+                        throw errno_error(xs("read MSS raw image file failed at line %s", comma_sep(done).sep()).s);
+                    }
+                    readTime += rsw.tick().ellapsed;
+                    if (!readBlocks.Push(blk)) break;
+                }
+            } catch (...) {
+                readError = std::current_exception();
+            }
+            readBlocks.Close();
+        });
+        
+        try {
+            Block blk;
+            while (readBlocks.Pop(blk)) {
+                stop_watch ssw;
+                int tasks = (int)((blk.lines + RRC_STREAM_TASKLINES - 1) / RRC_STREAM_TASKLINES);
+                ThreadPool::Shared().ParallelFor(tasks, [&](int t, int) {
+                    RRCVerifyStats taskVerified;
+                    size_t end = std::min(blk.lines, (size_t)(t + 1) * RRC_STREAM_TASKLINES);
+                    for (size_t i = (size_t)t * RRC_STREAM_TASKLINES; i < end; ++i) {
+                        for (int b = 0; b < MSS_BANDS; ++b) {
+                            uint16_t * line = mImageBandMSS[b].get() + (blk.line + i) * bandPixelsPerLine;
+                            memcpy(line, blk.data + i * PIXELS_PER_LINE + b * bandPixelsPerLine, bandBytesPerLine);
+                            if (kernels) kernels[b]->ApplyLineVerified(line, taskVerified);
+                        }
+                    }
+                    std::lock_guard<std::mutex> guard(verifyLock);
+                    verified.Merge(taskVerified);
+                });
+                splitTime += ssw.tick().ellapsed;
+                if (kernels) verified.Check(kernels[0]->Options());
+                freeBlocks.Push(blk);
+            }
+        } catch (...) {
+            freeBlocks.Close();
+            readBlocks.Close();
+            reader.join();
+            throw;
+        }
+        freeBlocks.Close();
+        reader.join();
+        if (readError) std::rethrow_exception(readError);
+        
+        auto es = sw.tick().ellapsed;
+        OLOG("LoadMSS(): %s bytes read & split%s in %s seconds (%s MBps), busy time: read %s, split %s seconds.",
+             comma_sep(mLinesMSS * PIXELS_PER_LINE * BYTES_PER_PIXEL).sep(),
+             kernels ? " & RRC-ed" : "",
+             comma_sep(es).sep(),
+             comma_sep(mSizeMSS/es/1024.0/1024.0).sep(),
+             comma_sep(readTime).sep(),
+             comma_sep(splitTime).sep());
+        if (kernels) verified.Log(kernels[0]->Options());
+    }
+    
 private:
     const std::string mPanFile;
     const std::string mMssFile;
@@ -591,8 +988,10 @@ private:
     scoped_ptr<InterBandShift> mBandShift[MSS_BANDS];
     scoped_ptr<uint16_t> mImagePAN;
     scoped_ptr<uint16_t> mImageBandMSS[MSS_BANDS];
-    //scoped_ptr<uint16_t> mAlignedMSS;
-    cv::Mat mAlignedMSS;
+    std::vector<cv::Mat> mSamplePAN;                // correlation sections, see `LoadCorrelationSamples()'
+    std::vector<cv::Mat> mSampleMSS[MSS_BANDS];
+    std::unique_ptr<ColumnShiftWarp> mBandWarp[MSS_BANDS];
+    std::unique_ptr<ColumnShiftRemap> mBandRemap[MSS_BANDS];
     
     double mDeltaXcoeffs[MSS_BANDS][2];
     double mDeltaYcoeffs[MSS_BANDS][3];
@@ -0,0 +1,174 @@
+//
+//  registrar.h
+//  OpticalImageProcessor
+//
+//  Created by Qiu PENG on 18/10/26.
+//
+
+#ifndef registrar_h
+#define registrar_h
+
+#include <math.h>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "oipshared.h"
+#include "phasecorr.h"
+#include "testimage.h"
+
+BEGIN_NS(OIP)
+
+const int PYR_MAX_LEVELS = 6;
+const int PYR_MIN_COARSE_SIZE = 32;     // coarsest level is at least this many px in both dimensions
+const int PYR_MIN_REFINE_SIZE = 16;     // refine window smaller than this falls back to full window
+const int PYR_DEF_REFINE_ROWS = 2048;
+const int PYR_DEF_REFINE_COLS = 2048;
+
+struct RegistrationOptions {
+    int levels;         // pyramid levels above full resolution, 0 correlates full windows directly
+    int refineRows;     // full resolution refine window
+    int refineCols;
+    bool smoothWindows; // crop correlation windows to 2/3/5-smooth sizes, see `SmoothSize()'
+
+    RegistrationOptions() :
+    levels(0), refineRows(PYR_DEF_REFINE_ROWS), refineCols(PYR_DEF_REFINE_COLS), smoothWindows(true) {}
+
+    /// process-wide options set from command line
+    static RegistrationOptions & Global() {
+        static RegistrationOptions options;
+        return options;
+    }
+};
+
+/// coarse-to-fine shift estimation against a fixed base image:
+/// the shift is first found by phase correlation on `levels' times pyrDown-ed images,
+/// then refined at full resolution on a small window pair placed `prediction' apart.
+/// result follows `cv::phaseCorrelate(base, image)': image(x, y) ~ base(x - dx, y - dy),
+/// response is that of the full resolution refinement.
+/// with `levels == 0' this is exactly `PhaseCorrelator' on the whole images.
+/// images may be CV_32FC1 or CV_16UC1 ROIs, which are converted straight into DFT buffers.
+/// not thread safe: use one instance per thread.
+class PyramidRegistrar {
+public:
+    explicit PyramidRegistrar(const cv::Mat & base,
+                              const RegistrationOptions & options = RegistrationOptions::Global())
+    : mBase(base), mOptions(options), mLevels(0) {
+        if (base.type() != CV_32FC1 && base.type() != CV_16UC1) {
+            throw std::invalid_argument("PyramidRegistrar: base image should be CV_32FC1 or CV_16UC1");
+        }
+        if (options.refineRows <= 0 || options.refineCols <= 0) {
+            throw std::invalid_argument("PyramidRegistrar: refine window size should be positive");
+        }
+
+        // drop levels that would make the coarsest image too small to correlate
+        int levels = std::min(std::max(options.levels, 0), PYR_MAX_LEVELS);
+        while (levels > 0 && std::min(base.rows, base.cols) >> levels < PYR_MIN_COARSE_SIZE) levels--;
+        mLevels = levels;
+
+        if (mLevels == 0) {
+            mFull.SetBase(base);
+            return;
+        }
+        mCoarse.SetBase(Downscale(base, mLevels));
+    }
+
+    int Levels() const { return mLevels; }
+
+    cv::Point2d Register(const cv::Mat & image, double * response = NULL) {
+        if ((image.type() != CV_32FC1 && image.type() != CV_16UC1) || image.rows != mBase.rows || image.cols != mBase.cols) {
+            throw std::invalid_argument("PyramidRegistrar: image should be CV_32FC1 or CV_16UC1 of the same size as base image");
+        }
+        if (mLevels == 0) return mFull.Correlate(image, response);
+
+        cv::Point2d predicted = mCoarse.Correlate(Downscale(image, mLevels));
+        int px = (int)lround(predicted.x * (1 << mLevels));
+        int py = (int)lround(predicted.y * (1 << mLevels));
+
+        // window pair `prediction' apart, both inside the images, centered as far as possible
+        int w = std::min(mOptions.refineCols, mBase.cols - abs(px));
+        int h = std::min(mOptions.refineRows, mBase.rows - abs(py));
+        if (mOptions.smoothWindows) {
+            w = SmoothSize(w);
+            h = SmoothSize(h);
+        }
+        if (w < PYR_MIN_REFINE_SIZE || h < PYR_MIN_REFINE_SIZE) {
+            // prediction leaves no usable overlap, fall back to the whole images
+            if (mFull.empty()) mFull.SetBase(mBase);
+            return mFull.Correlate(image, response);
+        }
+        int bx = Clamp((mBase.cols - w) / 2, std::max(0, -px), std::min(mBase.cols - w, mBase.cols - w - px));
+        int by = Clamp((mBase.rows - h) / 2, std::max(0, -py), std::min(mBase.rows - h, mBase.rows - h - py));
+        cv::Rect baseWindow(bx, by, w, h);
+        if (mRefine.empty() || baseWindow.x != mRefineWindow.x || baseWindow.y != mRefineWindow.y
+            || baseWindow.width != mRefineWindow.width || baseWindow.height != mRefineWindow.height) {
+            mRefine.SetBase(mBase(baseWindow));
+            mRefineWindow = baseWindow;
+        }
+        cv::Point2d residual = mRefine.Correlate(image(cv::Rect(bx + px, by + py, w, h)), response);
+        return cv::Point2d(px + residual.x, py + residual.y);
+    }
+
+    /// compare coarse-to-fine results with full window phase correlation on synthetic shifted textures,
+    /// throws if they differ by more than `maxError' px
+    static void SelfTest(int rows = 3000, int cols = 600, double maxError = 0.1) {
+        cv::Mat base = TestImage::SyntheticTexture(rows + 64, cols + 64, CV_32FC1, 0x6A09E667, 1000.0, 300.0, 22, 0.05, 0.03);
+        cv::Mat ref = base(cv::Rect(32, 32, cols, rows)).clone();
+        RegistrationOptions options;
+        options.levels = 2;
+        options.refineRows = 512;
+        options.refineCols = 512;
+        PyramidRegistrar full(ref, RegistrationOptions());
+        PyramidRegistrar pyramid(ref, options);
+        const int shifts[][2] = { {0, 0}, {5, -3}, {-17, 11}, {2, 29} };
+        for (auto & s : shifts) {
+            cv::Mat img = base(cv::Rect(32 + s[0], 32 + s[1], cols, rows)).clone();
+            double r0 = 0.0, r1 = 0.0;
+            stop_watch sw;
+            cv::Point2d v0 = full.Register(img, &r0);
+            auto t0 = sw.tick().ellapsed;
+            cv::Point2d v1 = pyramid.Register(img, &r1);
+            auto t1 = sw.tick().ellapsed;
+            double err = std::max(fabs(v0.x - v1.x), fabs(v0.y - v1.y));
+            OLOG("PyramidRegistrar [shift %d,%d]: full (%.4f, %.4f, %.4f) in %.4fs, pyramid (%.4f, %.4f, %.4f) in %.4fs.",
+                 s[0], s[1], v0.x, v0.y, r0, t0, v1.x, v1.y, r1, t1);
+            if (!(err <= maxError)) {
+                throw std::runtime_error(xs("PyramidRegistrar deviates from full window correlation by %g px", err).s);
+            }
+        }
+    }
+
+private:
+    /// `levels' times pyrDown-ed float image
+    static cv::Mat Downscale(const cv::Mat & image, int levels) {
+        cv::Mat coarse;
+        if (image.type() == CV_16UC1) PixelOps::U16ToF32Padded(image, coarse, image.rows, image.cols);
+        else coarse = image;
+        for (int l = 0; l < levels; ++l) {
+            cv::Mat down;
+            cv::pyrDown(coarse, down);
+            coarse = down;
+        }
+        return coarse;
+    }
+
+    static int Clamp(int v, int lo, int hi) {
+        return std::max(lo, std::min(v, hi));
+    }
+
+private:
+    cv::Mat mBase;
+    RegistrationOptions mOptions;
+    int mLevels;
+    PhaseCorrelator mFull;      // levels == 0 or fallback
+    PhaseCorrelator mCoarse;
+    PhaseCorrelator mRefine;
+    cv::Rect mRefineWindow;
+};
+
+END_NS
+
+#endif /* registrar_h */
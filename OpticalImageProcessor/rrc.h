@@ -0,0 +1,544 @@
+//
+//  rrc.h
+//  OpticalImageProcessor
+//
+//  Created by Qiu PENG on 18/10/26.
+//
+
+#ifndef rrc_h
+#define rrc_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "oipshared.h"
+#include "simd.h"
+#include "threadpool.h"
+
+BEGIN_NS(OIP)
+
+const int RRC_BLOCK_ROWS = 512; // rows per parallel RRC task
+const int RRC_LUT_MAXBITS = 12; // per-column LUT is 2^bits entries
+const int RRC_FIXED_MAXSHIFT = 16; // Q16.16 at most
+const int RRC_FIXED_MINSHIFT = 8;
+
+struct RRCParam {
+    double k;
+    double b;
+};
+
+enum RRCEngine {
+    RRC_ENGINE_DOUBLE = 0,  // double precision, reference
+    RRC_ENGINE_FIXED,       // per-column fixed-point coefficients, 32-bit integer lanes
+    RRC_ENGINE_LUT,         // per-column lookup tables, exact for input within effective bit depth
+};
+
+struct RRCOptions {
+    RRCEngine engine;
+    int bits;       // effective sensor bit depth, FIXED/LUT saturate input above 2^bits-1
+    bool verify;    // compare every corrected block against double precision RRC
+    int tolerance;  // max deviation (DN) allowed when verifying
+
+    RRCOptions() : engine(RRC_ENGINE_DOUBLE), bits(16), verify(false), tolerance(1) {}
+
+    /// process-wide options set from command line
+    static RRCOptions & Global() {
+        static RRCOptions options;
+        return options;
+    }
+
+    static bool ParseEngine(const std::string & name, RRCEngine & engine) {
+        if (name == "double") { engine = RRC_ENGINE_DOUBLE; return true; }
+        if (name == "fixed")  { engine = RRC_ENGINE_FIXED;  return true; }
+        if (name == "lut")    { engine = RRC_ENGINE_LUT;    return true; }
+        return false;
+    }
+
+    static const char * EngineName(RRCEngine engine) {
+        switch (engine) {
+            case RRC_ENGINE_FIXED: return "fixed";
+            case RRC_ENGINE_LUT:   return "lut";
+            default:               return "double";
+        }
+    }
+};
+
+/// `RRCOptions::verify' result accumulated over several blocks (i.e. of a streamed file), so it is logged once
+struct RRCVerifyStats {
+    int maxDev;     // max deviation (DN) from double precision RRC, -1 if nothing verified
+    size_t diff;    // pixels that differ
+
+    RRCVerifyStats() : maxDev(-1), diff(0) {}
+
+    void Merge(const RRCVerifyStats & other) {
+        maxDev = std::max(maxDev, other.maxDev);
+        diff += other.diff;
+    }
+
+    void Log(const RRCOptions & opt) const {
+        if (maxDev < 0) return;
+        OLOG("RRC verification [%s vs double]: max deviation %d DN, %s pixel(s) differ, tolerance %d DN.",
+             RRCOptions::EngineName(opt.engine), maxDev, comma_sep(diff).sep(), opt.tolerance);
+    }
+
+    /// throws if the max deviation exceeds the tolerance
+    void Check(const RRCOptions & opt) const {
+        if (maxDev > opt.tolerance) {
+            throw std::runtime_error(xs("RRC verification failed: max deviation %d DN exceeds tolerance %d DN",
+                                        maxDev, opt.tolerance).s);
+        }
+    }
+};
+
+struct AlignedDtor {
+    inline void operator()(void * p) { free(p); }
+};
+
+class RRCKernel;
+struct RRCJob {
+    uint16_t * buff;
+    size_t rows;
+    const RRCKernel * kernel;
+};
+
+/// Relative Radiometric Correction kernel: dst = saturate(trunc(k[x] * src + b[x]))
+/// per-column coefficients are converted once into 64-byte aligned arrays for the selected engine.
+/// DOUBLE keeps double precision so every SIMD path is bit-exact with the scalar one,
+/// FIXED & LUT trade exactness for integer lanes, see `RRCOptions::verify'.
+class RRCKernel {
+public:
+    RRCKernel(const RRCParam * rrcParam, int w, const RRCOptions & options = RRCOptions::Global())
+    : mWidth(w), mOptions(options), mShift(0), mMaxSrc(65535) {
+        mK = (double *)AllocAligned(sizeof(double) * w);
+        mB = (double *)AllocAligned(sizeof(double) * w);
+        for (int x = 0; x < w; ++x) {
+            mK[x] = rrcParam[x].k;
+            mB[x] = rrcParam[x].b;
+        }
+
+        if (options.bits < 1 || options.bits > 16) {
+            throw std::invalid_argument(xs("RRCKernel: invalid effective bit depth %d", options.bits).s);
+        }
+        if (options.engine != RRC_ENGINE_DOUBLE) {
+            mMaxSrc = (1 << options.bits) - 1;
+        }
+        if (options.engine == RRC_ENGINE_FIXED) PrepareFixed();
+        if (options.engine == RRC_ENGINE_LUT) PrepareLUT();
+    }
+
+    int Width() const { return mWidth; }
+    const RRCOptions & Options() const { return mOptions; }
+
+    /// correct `rows' lines of `Width()' pixels in place
+    void Apply(uint16_t * buff, size_t rows, SimdLevel level = Simd::Level()) const {
+        for (size_t y = 0; y < rows; ++y) {
+            ApplyLine(buff + y * mWidth, level);
+        }
+    }
+
+    void ApplyLine(uint16_t * line, SimdLevel level = Simd::Level()) const {
+        switch (mOptions.engine) {
+            case RRC_ENGINE_FIXED: ApplyLineFixed(line, level); break;
+            case RRC_ENGINE_LUT:   ApplyLineLUT(line, level); break;
+            default:               ApplyLineDouble(line, level); break;
+        }
+    }
+
+    /// `ApplyLine()', also compared with double precision RRC of the line when verifying (see `RRCOptions::verify'),
+    /// deviation is accumulated into `stats' (one per task, not thread safe) for the caller to log & check
+    void ApplyLineVerified(uint16_t * line, RRCVerifyStats & stats, SimdLevel level = Simd::Level()) const {
+        if (!mOptions.verify || mOptions.engine == RRC_ENGINE_DOUBLE) {
+            ApplyLine(line, level);
+            return;
+        }
+        std::vector<uint16_t> reference(line, line + mWidth);
+        ApplyLineDouble(reference.data(), level);
+        ApplyLine(line, level);
+        stats.maxDev = std::max(stats.maxDev, 0);
+        for (int x = 0; x < mWidth; ++x) {
+            int d = abs((int)line[x] - (int)reference[x]);
+            if (d > 0) stats.diff++;
+            if (d > stats.maxDev) stats.maxDev = d;
+        }
+    }
+
+    /// run all jobs split into row blocks on the shared thread pool,
+    /// logs throughput of each pool thread if `report' is set.
+    /// when verifying, each block is also corrected with double precision and compared,
+    /// throws if any pixel deviates more than the tolerance. the result is logged, unless it is
+    /// accumulated into `stats' for the caller to log once (streamed files call this per block).
+    static void ApplyParallel(const RRCJob * jobs, int count,
+                              size_t blockRows = RRC_BLOCK_ROWS,
+                              bool report = true,
+                              RRCVerifyStats * stats = NULL) {
+        struct Block {
+            const RRCJob * job;
+            size_t row;
+            size_t rows;
+        };
+        std::vector<Block> blocks;
+        for (int j = 0; j < count; ++j) {
+            for (size_t r = 0; r < jobs[j].rows; r += blockRows) {
+                blocks.push_back({ jobs + j, r, std::min(blockRows, jobs[j].rows - r) });
+            }
+        }
+
+        ThreadPool & pool = ThreadPool::Shared();
+        std::vector<double> busy(pool.Size(), 0.0);
+        std::vector<size_t> bytes(pool.Size(), 0);
+        std::vector<RRCVerifyStats> verified(pool.Size());
+        pool.ParallelFor((int)blocks.size(), [&](int i, int worker) {
+            const Block & blk = blocks[i];
+            const RRCKernel * kernel = blk.job->kernel;
+            uint16_t * data = blk.job->buff + blk.row * kernel->Width();
+            size_t pixels = blk.rows * kernel->Width();
+            std::vector<uint16_t> reference;
+            if (kernel->Options().verify && kernel->Options().engine != RRC_ENGINE_DOUBLE) {
+                reference.assign(data, data + pixels);
+                for (size_t y = 0; y < blk.rows; ++y) {
+                    kernel->ApplyLineDouble(reference.data() + y * kernel->Width(), Simd::Level());
+                }
+            }
+
+            stop_watch sw;
+            kernel->Apply(data, blk.rows);
+            busy[worker] += sw.tick().ellapsed;
+            bytes[worker] += pixels * BYTES_PER_PIXEL;
+
+            if (!reference.empty()) {
+                RRCVerifyStats & v = verified[worker];
+                v.maxDev = std::max(v.maxDev, 0);
+                for (size_t p = 0; p < pixels; ++p) {
+                    int d = abs((int)data[p] - (int)reference[p]);
+                    if (d > 0) v.diff++;
+                    if (d > v.maxDev) v.maxDev = d;
+                }
+            }
+        });
+
+        for (int t = 0; report && t < pool.Size(); ++t) {
+            if (bytes[t] == 0) continue;
+            OLOG("  RRC thread #%02d: %s bytes in %s seconds (%s MBps).",
+                 t,
+                 comma_sep(bytes[t]).sep(),
+                 comma_sep(busy[t]).sep(),
+                 comma_sep(bytes[t]/busy[t]/1024.0/1024.0).sep());
+        }
+
+        RRCVerifyStats total;
+        for (const RRCVerifyStats & v : verified) total.Merge(v);
+        if (count <= 0) return;
+        const RRCOptions & opt = jobs[0].kernel->Options();
+        if (stats) {
+            stats->Merge(total);
+        } else {
+            total.Log(opt);
+        }
+        total.Check(opt);
+    }
+
+    static inline uint16_t Saturate(double v) {
+        if (!(v > 0.0)) return 0;
+        if (v >= 65535.0) return 65535;
+        return (uint16_t)v;
+    }
+
+    static inline uint16_t Saturate(int32_t v) {
+        return (uint16_t)(v < 0 ? 0 : (v > 65535 ? 65535 : v));
+    }
+
+    /// bit-exactness check of every available SIMD path against the scalar path of each engine,
+    /// throws if any pixel differs; also reports FIXED/LUT deviation from DOUBLE
+    static void SelfTest(int w = PIXELS_PER_LINE, int rows = 64) {
+        scoped_ptr<RRCParam, array_dtor<RRCParam>> params = new RRCParam[w];
+        uint32_t seed = 0x9E3779B9;
+        auto rnd = [&]() { seed = seed * 1664525 + 1013904223; return seed >> 8; };
+        for (int x = 0; x < w; ++x) {
+            params[x].k = 0.5 + (rnd() % 20000) / 10000.0;   // [0.5, 2.5)
+            params[x].b = ((int)(rnd() % 40001) - 20000) / 100.0; // [-200, 200]
+        }
+        size_t pixels = (size_t)w * rows;
+        scoped_ptr<uint16_t, array_dtor<uint16_t>> source = new uint16_t[pixels];
+        scoped_ptr<uint16_t, array_dtor<uint16_t>> double0 = new uint16_t[pixels];
+        scoped_ptr<uint16_t, array_dtor<uint16_t>> expect = new uint16_t[pixels];
+        scoped_ptr<uint16_t, array_dtor<uint16_t>> actual = new uint16_t[pixels];
+
+        struct Case {
+            RRCEngine engine;
+            int bits;
+        } cases[] = {
+            { RRC_ENGINE_DOUBLE, 16 },
+            { RRC_ENGINE_FIXED,  16 },
+            { RRC_ENGINE_FIXED,  12 },
+            { RRC_ENGINE_LUT,    12 },
+        };
+        for (const Case & c : cases) {
+            uint32_t mask = (1u << c.bits) - 1;
+            for (size_t i = 0; i < pixels; ++i) {
+                // cover the whole input range, including values that saturate both ways
+                source[i] = (uint16_t)((i <= mask ? i : rnd()) & mask);
+            }
+            RRCOptions opt;
+            opt.engine = c.engine;
+            opt.bits = c.bits;
+            RRCKernel kernel(params, w, opt);
+            RRCKernel reference(params, w, RRCOptions());
+
+            memcpy(double0, source, pixels * BYTES_PER_PIXEL);
+            reference.Apply(double0, rows, SIMD_SCALAR);
+            memcpy(expect, source, pixels * BYTES_PER_PIXEL);
+            kernel.Apply(expect, rows, SIMD_SCALAR);
+            int dev = 0;
+            for (size_t i = 0; i < pixels; ++i) dev = std::max(dev, abs((int)expect[i] - (int)double0[i]));
+
+            for (int l = SIMD_AVX2; l <= Simd::Level(); ++l) {
+                memcpy(actual, source, pixels * BYTES_PER_PIXEL);
+                kernel.Apply(actual, rows, (SimdLevel)l);
+                size_t diff = 0;
+                for (size_t i = 0; i < pixels; ++i) {
+                    if (actual[i] != expect[i]) diff++;
+                }
+                OLOG("RRC kernel [%s/%d bits, %s]: %s pixels compared, %s mismatch(es), max deviation from double: %d DN.",
+                     RRCOptions::EngineName(c.engine), c.bits,
+                     Simd::Name((SimdLevel)l),
+                     comma_sep(pixels).sep(),
+                     comma_sep(diff).sep(),
+                     dev);
+                if (diff > 0) {
+                    throw std::runtime_error(xs("RRC kernel [%s, %s] is not bit-exact with its scalar path",
+                                                RRCOptions::EngineName(c.engine), Simd::Name((SimdLevel)l)).s);
+                }
+            }
+        }
+    }
+
+private:
+    static void * AllocAligned(size_t bytes) {
+        void * p = NULL;
+        if (posix_memalign(&p, 64, bytes > 0 ? bytes : 1)) throw std::bad_alloc();
+        return p;
+    }
+
+    /// largest shift (<= 16) with which `k * maxSrc + b' can't overflow 31 bits in any column
+    void PrepareFixed() {
+        double maxAbs = 1.0;
+        for (int x = 0; x < mWidth; ++x) {
+            maxAbs = std::max(maxAbs, fabs(mK[x]) * mMaxSrc + fabs(mB[x]) + 1.0);
+        }
+        mShift = std::min(RRC_FIXED_MAXSHIFT, (int)floor(log2(2147483647.0 / maxAbs)));
+        if (mShift < RRC_FIXED_MINSHIFT) {
+            throw std::invalid_argument(xs("RRCKernel: coefficients out of range for fixed-point RRC "
+                                           "(only %d fraction bits left), use double engine", mShift).s);
+        }
+        mKq = (int32_t *)AllocAligned(sizeof(int32_t) * mWidth);
+        mBq = (int32_t *)AllocAligned(sizeof(int32_t) * mWidth);
+        for (int x = 0; x < mWidth; ++x) {
+            mKq[x] = (int32_t)lround(ldexp(mK[x], mShift));
+            mBq[x] = (int32_t)lround(ldexp(mB[x], mShift));
+        }
+        OLOG("RRCKernel: fixed-point engine with Q%d.%d coefficients for %d-bit input.",
+             31 - mShift, mShift, mOptions.bits);
+    }
+
+    void PrepareLUT() {
+        if (mOptions.bits > RRC_LUT_MAXBITS) {
+            throw std::invalid_argument(xs("RRCKernel: LUT engine needs effective bit depth <= %d, %d given",
+                                           RRC_LUT_MAXBITS, mOptions.bits).s);
+        }
+        size_t entries = (size_t)1 << mOptions.bits;
+        // 2 bytes padding: SIMD path gathers 32-bit words
+        mLut = (uint16_t *)AllocAligned(sizeof(uint16_t) * (entries * mWidth + 2));
+        for (int x = 0; x < mWidth; ++x) {
+            uint16_t * lut = mLut + x * entries;
+            for (size_t v = 0; v < entries; ++v) {
+                lut[v] = Saturate(mK[x] * (double)v + mB[x]);
+            }
+        }
+        mLut[entries * mWidth] = mLut[entries * mWidth + 1] = 0;
+        OLOG("RRCKernel: LUT engine with %s bytes of %d-bit per-column tables.",
+             comma_sep(sizeof(uint16_t) * entries * mWidth).sep(), mOptions.bits);
+    }
+
+    void ApplyLineDouble(uint16_t * line, SimdLevel level) const {
+        int x = 0;
+#if OIP_SIMD_X86
+        if (level >= SIMD_AVX512) x = ApplyLineAVX512(line);
+        else if (level >= SIMD_AVX2) x = ApplyLineAVX2(line);
+#endif
+        for (; x < mWidth; ++x) {
+            line[x] = Saturate(mK[x] * line[x] + mB[x]);
+        }
+    }
+
+    void ApplyLineFixed(uint16_t * line, SimdLevel level) const {
+        int x = 0;
+#if OIP_SIMD_X86
+        if (level >= SIMD_AVX512) x = ApplyLineFixedAVX512(line);
+        else if (level >= SIMD_AVX2) x = ApplyLineFixedAVX2(line);
+#endif
+        for (; x < mWidth; ++x) {
+            int32_t src = std::min((int32_t)line[x], mMaxSrc);
+            line[x] = Saturate((int32_t)(mKq[x] * src + mBq[x]) >> mShift);
+        }
+    }
+
+    void ApplyLineLUT(uint16_t * line, SimdLevel level) const {
+        const int bits = mOptions.bits;
+        int x = 0;
+#if OIP_SIMD_X86
+        if (level >= SIMD_AVX2) x = ApplyLineLUTAVX2(line);
+#endif
+        for (; x < mWidth; ++x) {
+            int32_t src = std::min((int32_t)line[x], mMaxSrc);
+            line[x] = mLut[((size_t)x << bits) + src];
+        }
+    }
+
+#if OIP_SIMD_X86
+    /// 16 pixels per iteration, 4 x 4 doubles
+    OIP_TARGET("avx2")
+    int ApplyLineAVX2(uint16_t * line) const {
+        const __m256d lo = _mm256_setzero_pd();
+        const __m256d hi = _mm256_set1_pd(65535.0);
+        int x = 0;
+        for (; x + 16 <= mWidth; x += 16) {
+            __m256i px = _mm256_loadu_si256((const __m256i *)(line + x));
+            __m256i d0 = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(px));
+            __m256i d1 = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(px, 1));
+            __m128i q[4];
+            const __m128i src[4] = {
+                _mm256_castsi256_si128(d0), _mm256_extracti128_si256(d0, 1),
+                _mm256_castsi256_si128(d1), _mm256_extracti128_si256(d1, 1),
+            };
+            for (int i = 0; i < 4; ++i) {
+                __m256d v = _mm256_cvtepi32_pd(src[i]);
+                v = _mm256_add_pd(_mm256_mul_pd(_mm256_load_pd(mK + x + i * 4), v),
+                                  _mm256_load_pd(mB + x + i * 4));
+                v = _mm256_min_pd(_mm256_max_pd(v, lo), hi);
+                q[i] = _mm256_cvttpd_epi32(v);
+            }
+            __m128i r0 = _mm_packus_epi32(q[0], q[1]);
+            __m128i r1 = _mm_packus_epi32(q[2], q[3]);
+            _mm256_storeu_si256((__m256i *)(line + x), _mm256_set_m128i(r1, r0));
+        }
+        return x;
+    }
+
+    /// 32 pixels per iteration, 4 x 8 doubles
+    OIP_TARGET("avx512f,avx512bw")
+    int ApplyLineAVX512(uint16_t * line) const {
+        const __m512d lo = _mm512_setzero_pd();
+        const __m512d hi = _mm512_set1_pd(65535.0);
+        int x = 0;
+        for (; x + 32 <= mWidth; x += 32) {
+            __m512i px = _mm512_loadu_si512((const void *)(line + x));
+            __m512i d0 = _mm512_cvtepu16_epi32(_mm512_castsi512_si256(px));
+            __m512i d1 = _mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(px, 1));
+            __m256i q[4];
+            const __m256i src[4] = {
+                _mm512_castsi512_si256(d0), _mm512_extracti64x4_epi64(d0, 1),
+                _mm512_castsi512_si256(d1), _mm512_extracti64x4_epi64(d1, 1),
+            };
+            for (int i = 0; i < 4; ++i) {
+                __m512d v = _mm512_cvtepi32_pd(src[i]);
+                // explicit rounding forms keep the compiler from contracting into FMA,
+                // which would not be bit-exact with the scalar path
+                v = _mm512_mul_round_pd(_mm512_load_pd(mK + x + i * 8), v, _MM_FROUND_CUR_DIRECTION);
+                v = _mm512_add_round_pd(v, _mm512_load_pd(mB + x + i * 8), _MM_FROUND_CUR_DIRECTION);
+                v = _mm512_min_pd(_mm512_max_pd(v, lo), hi);
+                q[i] = _mm512_cvttpd_epi32(v);
+            }
+            __m512i r0 = _mm512_inserti64x4(_mm512_castsi256_si512(q[0]), q[1], 1);
+            __m512i r1 = _mm512_inserti64x4(_mm512_castsi256_si512(q[2]), q[3], 1);
+            _mm256_storeu_si256((__m256i *)(line + x), _mm512_cvtepi32_epi16(r0));
+            _mm256_storeu_si256((__m256i *)(line + x + 16), _mm512_cvtepi32_epi16(r1));
+        }
+        return x;
+    }
+
+    /// 16 pixels per iteration, 2 x 8 int32
+    OIP_TARGET("avx2")
+    int ApplyLineFixedAVX2(uint16_t * line) const {
+        const __m256i maxSrc = _mm256_set1_epi32(mMaxSrc);
+        const __m128i shift = _mm_cvtsi32_si128(mShift);
+        int x = 0;
+        for (; x + 16 <= mWidth; x += 16) {
+            __m256i px = _mm256_loadu_si256((const __m256i *)(line + x));
+            __m256i d0 = _mm256_min_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(px)), maxSrc);
+            __m256i d1 = _mm256_min_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(px, 1)), maxSrc);
+            d0 = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_load_si256((const __m256i *)(mKq + x)), d0),
+                                  _mm256_load_si256((const __m256i *)(mBq + x)));
+            d1 = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_load_si256((const __m256i *)(mKq + x + 8)), d1),
+                                  _mm256_load_si256((const __m256i *)(mBq + x + 8)));
+            d0 = _mm256_sra_epi32(d0, shift);
+            d1 = _mm256_sra_epi32(d1, shift);
+            // packus works per 128-bit lane, restore pixel order afterwards
+            __m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi32(d0, d1), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm256_storeu_si256((__m256i *)(line + x), r);
+        }
+        return x;
+    }
+
+    /// 32 pixels per iteration, 2 x 16 int32
+    OIP_TARGET("avx512f,avx512bw")
+    int ApplyLineFixedAVX512(uint16_t * line) const {
+        const __m512i maxSrc = _mm512_set1_epi32(mMaxSrc);
+        const __m512i zero = _mm512_setzero_si512();
+        const __m128i shift = _mm_cvtsi32_si128(mShift);
+        int x = 0;
+        for (; x + 32 <= mWidth; x += 32) {
+            __m512i px = _mm512_loadu_si512((const void *)(line + x));
+            __m512i d0 = _mm512_min_epi32(_mm512_cvtepu16_epi32(_mm512_castsi512_si256(px)), maxSrc);
+            __m512i d1 = _mm512_min_epi32(_mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(px, 1)), maxSrc);
+            d0 = _mm512_add_epi32(_mm512_mullo_epi32(_mm512_load_si512((const void *)(mKq + x)), d0),
+                                  _mm512_load_si512((const void *)(mBq + x)));
+            d1 = _mm512_add_epi32(_mm512_mullo_epi32(_mm512_load_si512((const void *)(mKq + x + 16)), d1),
+                                  _mm512_load_si512((const void *)(mBq + x + 16)));
+            d0 = _mm512_max_epi32(_mm512_sra_epi32(d0, shift), zero);
+            d1 = _mm512_max_epi32(_mm512_sra_epi32(d1, shift), zero);
+            _mm256_storeu_si256((__m256i *)(line + x), _mm512_cvtusepi32_epi16(d0));
+            _mm256_storeu_si256((__m256i *)(line + x + 16), _mm512_cvtusepi32_epi16(d1));
+        }
+        return x;
+    }
+
+    /// 8 pixels per iteration, table entries gathered as 32-bit words
+    OIP_TARGET("avx2")
+    int ApplyLineLUTAVX2(uint16_t * line) const {
+        const int bits = mOptions.bits;
+        const __m256i maxSrc = _mm256_set1_epi32(mMaxSrc);
+        const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        const __m256i low16 = _mm256_set1_epi32(0xFFFF);
+        int x = 0;
+        for (; x + 8 <= mWidth; x += 8) {
+            __m256i src = _mm256_min_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(line + x))), maxSrc);
+            __m256i col = _mm256_add_epi32(_mm256_set1_epi32(x), lane);
+            __m256i idx = _mm256_add_epi32(_mm256_slli_epi32(col, bits), src);
+            __m256i v = _mm256_and_si256(_mm256_i32gather_epi32((const int *)mLut.get(), idx, 2), low16);
+            __m128i r = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+            _mm_storeu_si128((__m128i *)(line + x), r);
+        }
+        return x;
+    }
+#endif
+
+private:
+    int mWidth;
+    RRCOptions mOptions;
+    int mShift;
+    int32_t mMaxSrc;
+    scoped_ptr<double, AlignedDtor> mK;
+    scoped_ptr<double, AlignedDtor> mB;
+    scoped_ptr<int32_t, AlignedDtor> mKq;
+    scoped_ptr<int32_t, AlignedDtor> mBq;
+    scoped_ptr<uint16_t, AlignedDtor> mLut;
+};
+
+END_NS
+
+#endif /* rrc_h */
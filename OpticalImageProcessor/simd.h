@@ -0,0 +1,90 @@
+//
+//  simd.h
+//  OpticalImageProcessor
+//
+//  Created by Qiu PENG on 18/10/26.
+//
+
+#ifndef simd_h
+#define simd_h
+
+#include <algorithm>
+#include <string>
+
+#include "oipshared.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define OIP_SIMD_X86        1
+#include <immintrin.h>
+#define OIP_TARGET(isa)     __attribute__((target(isa)))
+#else
+#define OIP_SIMD_X86        0
+#define OIP_TARGET(isa)
+#endif
+
+BEGIN_NS(OIP)
+
+enum SimdLevel {
+    SIMD_SCALAR = 0,
+    SIMD_SSE41,
+    SIMD_AVX2,
+    SIMD_AVX512,
+};
+
+/// runtime CPU feature detection for hand-vectorized kernels,
+/// kernels are compiled per ISA with `OIP_TARGET' and selected by `Simd::Level()'
+class Simd {
+public:
+    static SimdLevel Detected() {
+        static SimdLevel level = Detect();
+        return level;
+    }
+
+    /// effective level: detected level capped by `SetMaxLevel()'
+    static SimdLevel Level() {
+        return std::min(Detected(), MaxLevel());
+    }
+
+    static void SetMaxLevel(SimdLevel level) {
+        MaxLevel() = level;
+    }
+
+    static const char * Name(SimdLevel level) {
+        switch (level) {
+            case SIMD_SSE41:  return "SSE4.1";
+            case SIMD_AVX2:   return "AVX2";
+            case SIMD_AVX512: return "AVX-512";
+            default:          return "scalar";
+        }
+    }
+
+    /// parse `scalar', `sse4.1', `avx2', `avx512' or `auto'
+    static bool Parse(const std::string & name, SimdLevel & level) {
+        if (name == "auto")   { level = SIMD_AVX512; return true; }
+        if (name == "scalar") { level = SIMD_SCALAR; return true; }
+        if (name == "sse4.1") { level = SIMD_SSE41;  return true; }
+        if (name == "avx2")   { level = SIMD_AVX2;   return true; }
+        if (name == "avx512") { level = SIMD_AVX512; return true; }
+        return false;
+    }
+
+private:
+    static SimdLevel & MaxLevel() {
+        static SimdLevel level = SIMD_AVX512;
+        return level;
+    }
+
+    static SimdLevel Detect() {
+#if OIP_SIMD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) return SIMD_AVX512;
+        if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+        if (__builtin_cpu_supports("sse4.1")) return SIMD_SSE41;
+#endif
+        return SIMD_SCALAR;
+    }
+};
+
+END_NS
+
+#endif /* simd_h */
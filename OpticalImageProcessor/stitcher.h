@@ -8,13 +8,22 @@
 #ifndef stitcher_h
 #define stitcher_h
 
+#include <algorithm>
+#include <deque>
+#include <vector>
+
 #include <opencv2/core/mat.hpp>
 
 #include "oipshared.h"
 #include "imageop.h"
+#include "registrar.h"
+#include "paramcache.h"
+#include "warp.h"
 
 BEGIN_NS(OIP)
 
+const int PRESTT_STRIPE_ROWS = 4096;    // output rows per read/warp/write round of the analytic pre-stitch
+
 class Stitcher
 {
 public:
@@ -84,6 +93,9 @@ public:
         mPreSttFilePAN2 = IMO::BuildOutputFilePath(mRrcFilePAN2, PRESTT_STEM_EXT);
         scoped_ptr<FILE, FileDtor> fPan2 = fopen(mRrcFilePAN2.c_str(), "rb");
         scoped_ptr<FILE, FileDtor> fPreStt2 = fopen(mPreSttFilePAN2.c_str(), "wb");
+        if (WarpOptions::Global().stitchEngine == WARP_ENGINE_ANALYTIC) {
+            return PreStitchAnalytic(fPan2, fPreStt2);
+        }
         
         cv::Mat1w buff(REMAP_SECTION_ROWS, PIXELS_PER_LINE);
         cv::Mat1f mapx(REMAP_SECTION_ROWS, PIXELS_PER_LINE);
@@ -138,16 +150,93 @@ public:
         return imageLines;
     }
     
-    void DoRRC() {
+    /// analytic engine: the constant (dx, dy) shift as a `ColumnShiftWarp' (`--quality' kernel) over the whole strip, streamed in
+    /// `PRESTT_STRIPE_ROWS' row stripes that read just their source window, so there are no section seams and
+    /// memory is O(stripe); output has all `mLinesPAN' lines, zero where the shifted source is outside PAN2
+    int PreStitchAnalytic(FILE * fPan2, FILE * fPreStt2) {
+        ColumnShift model;
+        model.mapX.resize(PIXELS_PER_LINE);
+        model.shiftY.assign(PIXELS_PER_LINE, mDeltaY);
+        for (int x = 0; x < PIXELS_PER_LINE; ++x) model.mapX[x] = x + mDeltaX;
+        ColumnShiftWarp warp(model, WarpOptions::Global().quality);
+        OLOG("Pre-stitching PAN2 with %s %s kernels ...", WarpOptions::QualityName(warp.Interp()), Simd::Name(Simd::Level()));
+        
+        const size_t row_bytes = BYTES_PER_PANLINE;
+        std::vector<uint16_t> window, out((size_t)PRESTT_STRIPE_ROWS * PIXELS_PER_LINE);
+        stop_watch sw;
+        double readTime = 0.0, warpTime = 0.0, writeTime = 0.0;
+        for (int y0 = 0; y0 < mLinesPAN; y0 += PRESTT_STRIPE_ROWS) {
+            int y1 = std::min(mLinesPAN, y0 + PRESTT_STRIPE_ROWS);
+            int s, e;
+            warp.SourceWindow(y0, y1, mLinesPAN, s, e);
+            window.resize((size_t)(e - s) * PIXELS_PER_LINE);
+            stop_watch rsw;
+            if (fseeko(fPan2, (off_t)s * row_bytes, SEEK_SET)) {
+                throw errno_error(xs("seek file [%s] failed", mRrcFilePAN2.c_str()).s);
+            }
+            if (fread(window.data(), row_bytes, e - s, fPan2) < (size_t)(e - s)) {
+                throw std::runtime_error("PreStitch(): not enough data read from RRC PAN2 raw file");
+            }
+            readTime += rsw.tick().ellapsed;
+            
+            stop_watch csw;
+            int blocks = (y1 - y0 + WARP_BLOCK_ROWS - 1) / WARP_BLOCK_ROWS;
+            ThreadPool::Shared().ParallelFor(blocks, [&](int b, int) {
+                int r0 = y0 + b * WARP_BLOCK_ROWS, r1 = std::min(y1, r0 + WARP_BLOCK_ROWS);
+                warp.Apply(window.data(), PIXELS_PER_LINE, e - s, PIXELS_PER_LINE,
+                           out.data() + (size_t)(r0 - y0) * PIXELS_PER_LINE, PIXELS_PER_LINE, 1, r0 - s, r1 - s);
+            });
+            warpTime += csw.tick().ellapsed;
+            
+            stop_watch wsw;
+            if (fwrite(out.data(), row_bytes, y1 - y0, fPreStt2) != (size_t)(y1 - y0)) {
+                throw std::runtime_error("PreStitch(): not enough data written to pre-stitched PAN2 raw file");
+            }
+            writeTime += wsw.tick().ellapsed;
+        }
+        auto es = sw.tick().ellapsed;
+        OLOG("Pre-stitched PAN2 written to file '%s'.", mPreSttFilePAN2.c_str());
+        OLOG("%s bytes processed & written in %s seconds (%s MBps), busy time: read %s, warp %s, write %s seconds.",
+             comma_sep(mSizePAN).sep(),
+             comma_sep(es).sep(),
+             comma_sep(mSizePAN/es/(1024.0*1024.0)).sep(),
+             comma_sep(readTime).sep(),
+             comma_sep(warpTime).sep(),
+             comma_sep(writeTime).sep());
+        return mLinesPAN;
+    }
+    
+    void DoRRC(bool streaming = true, int blockLines = RRC_STREAM_BLOCKLINES) {
         mRrcFilePAN1 = IMO::BuildOutputFilePath(mFilePAN1, RRC_STEM_EXT);
         mRrcFilePAN2 = IMO::BuildOutputFilePath(mFilePAN2, RRC_STEM_EXT);
-        IMO::DoRRC4RAW(mFilePAN1, PIXELS_PER_LINE, mParamFileRRC1, mRrcFilePAN1);
-        IMO::DoRRC4RAW(mFilePAN2, PIXELS_PER_LINE, mParamFileRRC2, mRrcFilePAN2);
+        if (!streaming) {
+            IMO::DoRRC4RAW(mFilePAN1, PIXELS_PER_LINE, mParamFileRRC1, mRrcFilePAN1);
+            IMO::DoRRC4RAW(mFilePAN2, PIXELS_PER_LINE, mParamFileRRC2, mRrcFilePAN2);
+            return;
+        }
+        
+        // PAN1 & PAN2 are streamed concurrently, RRC of both goes to the shared thread pool
+        stop_watch sw;
+        auto pan2 = std::async(std::launch::async, [&]() {
+            IMO::StreamRRC4RAW(mFilePAN2, PIXELS_PER_LINE, mParamFileRRC2, mRrcFilePAN2, blockLines);
+        });
+        IMO::StreamRRC4RAW(mFilePAN1, PIXELS_PER_LINE, mParamFileRRC1, mRrcFilePAN1, blockLines);
+        pan2.get();
+        auto es = sw.tick().ellapsed;
+        OLOG("RRC of PAN1 & PAN2 done in %s seconds (%s MBps).",
+             comma_sep(es).sep(),
+             comma_sep(mSizePAN*2/es/(1024.0*1024.0)).sep());
     }
     
+    /// with `tolerance' > 0, sections are processed middle-out (see `SpreadOrder()') and the estimate is the
+    /// median of valid values, stopping once the 95% confidence half-width of both medians is within
+    /// `tolerance' px (after `STT_ADAPTIVE_MIN' valid sections); `timeBudget' > 0 (seconds) stops as well.
+    /// otherwise all sections are correlated and averaged.
     void CalcSttParameters(double threshold = STT_DEF_PHCTHRHLD,
                            double maxDeltaY = STT_DEF_MAXDELTAY,
-                           int edgeCols = STT_DEF_EDGECOLS) {
+                           int edgeCols = STT_DEF_EDGECOLS,
+                           double tolerance = 0.0,
+                           double timeBudget = 0.0) {
         int gapLines = (mLinesPAN - mSections * mLinePerSection) / (mSections + 1);
         int stepLines = gapLines + mLinePerSection;
         int sectionBytes = mLinePerSection * BYTES_PER_PANLINE;
@@ -160,10 +249,28 @@ public:
         mResponse = 0.0;
         int valid = 0;
         
+        // correlation windows cropped (centered) to 2/3/5-smooth sizes
+        int winRows = mLinePerSection, winCols = mOverlapCols - edgeCols, winRowOff = 0, winColOff = 0;
+        if (RegistrationOptions::Global().smoothWindows) {
+            winRows = SmoothSize(mLinePerSection);
+            winCols = SmoothSize(mOverlapCols - edgeCols);
+            winRowOff = (mLinePerSection - winRows) / 2;
+            winColOff = (mOverlapCols - edgeCols - winCols) / 2;
+            OLOG("Correlation windows cropped to smooth sizes: %dx%d -> %dx%d.",
+                 mOverlapCols - edgeCols, mLinePerSection, winCols, winRows);
+        }
+        
+        bool adaptive = tolerance > 0.0 || timeBudget > 0.0;
+        std::vector<int> order = adaptive ? SpreadOrder(mSections) : std::vector<int>();
+        std::vector<double> dxs, dys;
+        double spent = 0.0;
+        stop_watch sw;
+        
         OLOG("Calculating stitching delta values ...");
         RLOG("| offset |  delta x |  delta y | response | r |");
         RLOG("-----------------------------------------------");
-        for (int i = 0; i < mSections; ++i) {
+        for (int k = 0; k < mSections; ++k) {
+            int i = adaptive ? order[k] : k;
             int line_offset = gapLines + i * stepLines;
             size_t offset = (size_t)line_offset * BYTES_PER_PANLINE;
             IMO::ReadFileContent(mRrcFilePAN1, rb, offset, sectionBytes, (char *)section1.data);
@@ -171,24 +278,45 @@ public:
             IMO::ReadFileContent(mRrcFilePAN2, rb, offset, sectionBytes, (char *)section2.data);
             //OLOG("%ld bytes read from PAN2", rb);
 
-            /// cv::Mat::colRange(startIncluded, endExcluded), col is 0-based
-            cv::Mat1f sliceF1 = section1.colRange(PIXELS_PER_LINE - mOverlapCols, PIXELS_PER_LINE - edgeCols);
-            cv::Mat1f sliceF2 = section2.colRange(edgeCols, mOverlapCols);
+            /// right edge of PAN1 & left edge of PAN2, same crop offsets keep their relative position
+            /// uint16 ROIs are converted straight into the padded DFT buffers
+            cv::Mat slice1 = section1(cv::Rect(PIXELS_PER_LINE - mOverlapCols + winColOff, winRowOff, winCols, winRows));
+            cv::Mat slice2 = section2(cv::Rect(edgeCols + winColOff, winRowOff, winCols, winRows));
 
             double resp = 0.0;
             cv::Point2d rv;
-            rv = cv::phaseCorrelate(sliceF1.clone(), sliceF2.clone(), cv::noArray(), &resp);
+            rv = PyramidRegistrar(slice1).Register(slice2, &resp);
             bool isValid = resp >= threshold && (maxDeltaY <= 0.0 || std::abs(rv.y) <= maxDeltaY);
             if (isValid) {
                 mDeltaX   += rv.x;
                 mDeltaY   += rv.y;
                 mResponse += resp;
                 valid++;
+                dxs.push_back(rv.x);
+                dys.push_back(rv.y);
             }
             RLOG("|%7d |%10.4f|%10.4f|%10.4f|%s|",
                  line_offset, rv.x, rv.y, resp,
                  isValid ? " ✔︎ " : " ✘ ");
+            
+            if (!adaptive || k + 1 == mSections) continue;
+            double mx = 0.0, my = 0.0, hx = 0.0, hy = 0.0;
+            if (tolerance > 0.0 && valid >= STT_ADAPTIVE_MIN) {
+                RobustEstimate(dxs, mx, hx);
+                RobustEstimate(dys, my, hy);
+                if (hx <= tolerance && hy <= tolerance) {
+                    OLOG("Converged after %d of %d sections: dx %.5f +/- %.5f, dy %.5f +/- %.5f.",
+                         k + 1, mSections, mx, hx, my, hy);
+                    break;
+                }
+            }
+            spent += sw.tick().ellapsed;
+            if (timeBudget > 0.0 && spent >= timeBudget) {
+                OLOG("Time budget (%s seconds) used up after %d of %d sections.", comma_sep(timeBudget).sep(), k + 1, mSections);
+                break;
+            }
         }
+        FFTWorkspaceCache::Clear();
         if (valid == 0) {
             throw std::runtime_error("No valid delta value found for stitching parameter calculating");
         }
@@ -196,7 +324,74 @@ public:
         mDeltaX   /= valid;
         mDeltaY   /= valid;
         mResponse /= valid;
-        OLOG("Total %d valid delta value pairs found, everage value:", valid);
+        if (adaptive) {
+            double hx = 0.0, hy = 0.0;
+            RobustEstimate(dxs, mDeltaX, hx);
+            RobustEstimate(dys, mDeltaY, hy);
+            OLOG("Total %d valid delta value pairs found, median value (95%% confidence dx +/- %.5f, dy +/- %.5f):",
+                 valid, hx, hy);
+        } else {
+            OLOG("Total %d valid delta value pairs found, everage value:", valid);
+        }
+        OLOG("    dx: %.5f, dy: %.5f, r: %.5f", mDeltaX, mDeltaY, mResponse);
+    }
+    
+    /// 0 .. n-1 breadth-first by bisection: middle first, then middles of both halves and so on,
+    /// so any prefix is spread over the whole range
+    static std::vector<int> SpreadOrder(int n) {
+        std::vector<int> order;
+        std::deque<std::pair<int, int>> ranges = { { 0, n } };
+        while (!ranges.empty()) {
+            auto r = ranges.front();
+            ranges.pop_front();
+            if (r.first >= r.second) continue;
+            int mid = (r.first + r.second) / 2;
+            order.push_back(mid);
+            ranges.push_back({ r.first, mid });
+            ranges.push_back({ mid + 1, r.second });
+        }
+        return order;
+    }
+    
+    /// median of `values' and 95% confidence half-width of it, from the MAD (normal consistent)
+    static void RobustEstimate(std::vector<double> values, double & median, double & halfWidth) {
+        auto mid = [](std::vector<double> & v) {
+            size_t h = v.size() / 2;
+            std::nth_element(v.begin(), v.begin() + h, v.end());
+            double m = v[h];
+            if (v.size() % 2 == 0) m = (m + *std::max_element(v.begin(), v.begin() + h)) / 2.0;
+            return m;
+        };
+        median = mid(values);
+        for (auto & v : values) v = fabs(v - median);
+        // sqrt(pi / 2): standard error of the median relative to that of the mean
+        halfWidth = 1.96 * 1.4826 * mid(values) * 1.2533 / sqrt((double)values.size());
+    }
+    
+    /// fingerprint of the inputs & every option `CalcSttParameters()' results depend on
+    std::string SttCacheKey(double threshold = STT_DEF_PHCTHRHLD,
+                            double maxDeltaY = STT_DEF_MAXDELTAY,
+                            int edgeCols = STT_DEF_EDGECOLS,
+                            double tolerance = 0.0,
+                            double timeBudget = 0.0) const {
+        const RegistrationOptions & ro = RegistrationOptions::Global();
+        Fingerprint fp;
+        fp.Add(PCACHE_KIND_STITCH).AddFile(mRrcFilePAN1).AddFile(mRrcFilePAN2);
+        fp.Add(mSections).Add(mLinePerSection).Add(mOverlapCols).Add(threshold).Add(maxDeltaY).Add(edgeCols);
+        fp.Add(tolerance).Add(timeBudget);
+        fp.Add(ro.levels).Add(ro.refineRows).Add(ro.refineCols).Add(ro.smoothWindows);
+        return fp.Hex();
+    }
+    
+    void ExportSttParams(ParamRecord & record) const {
+        record.Set("delta", { mDeltaX, mDeltaY, mResponse });
+    }
+    
+    void ImportSttParams(const ParamRecord & record) {
+        auto & delta = record.Get("delta", 3);
+        mDeltaX = delta[0];
+        mDeltaY = delta[1];
+        mResponse = delta[2];
         OLOG("    dx: %.5f, dy: %.5f, r: %.5f", mDeltaX, mDeltaY, mResponse);
     }
     
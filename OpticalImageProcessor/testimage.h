@@ -0,0 +1,47 @@
+//
+//  testimage.h
+//  OpticalImageProcessor
+//
+//  Created by Qiu PENG on 18/10/26.
+//
+
+#ifndef testimage_h
+#define testimage_h
+
+#include <math.h>
+#include <stdint.h>
+#include <stdexcept>
+
+#include <opencv2/core.hpp>
+
+#include "oipshared.h"
+
+BEGIN_NS(OIP)
+
+/// deterministic synthetic images shared by the `selftest' & benchmark fixtures
+class TestImage {
+public:
+    /// `base' + `amplitude' * sin(x * `kx') * cos(y * `ky') plus LCG noise (`seed' >> `noiseShift'), row-major,
+    /// single channel `type' (CV_16U or CV_32F), same `seed' gives the same image
+    static cv::Mat SyntheticTexture(int rows, int cols, int type, uint32_t seed,
+                                    double base, double amplitude, int noiseShift,
+                                    double kx = 0.07, double ky = 0.05) {
+        if (type != CV_16UC1 && type != CV_32FC1) {
+            throw std::invalid_argument("SyntheticTexture(): only CV_16UC1 & CV_32FC1 are supported");
+        }
+        cv::Mat image(rows, cols, type);
+        for (int y = 0; y < rows; ++y) {
+            for (int x = 0; x < cols; ++x) {
+                seed = seed * 1664525 + 1013904223;
+                double v = base + amplitude * sin(x * kx) * cos(y * ky) + (seed >> noiseShift);
+                if (type == CV_16UC1) image.at<uint16_t>(y, x) = cv::saturate_cast<uint16_t>(v);
+                else image.at<float>(y, x) = (float)v;
+            }
+        }
+        return image;
+    }
+};
+
+END_NS
+
+#endif /* testimage_h */
@@ -0,0 +1,203 @@
+//
+//  threadpool.h
+//  OpticalImageProcessor
+//
+//  Created by Qiu PENG on 18/10/26.
+//
+
+#ifndef threadpool_h
+#define threadpool_h
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "oipshared.h"
+
+BEGIN_NS(OIP)
+
+/// fixed size worker pool shared by all parallel stages, size is set by `--threads'
+class ThreadPool {
+public:
+    /// 0 means one thread per hardware thread, takes effect only before first `Shared()' call
+    static void SetThreads(int threads) {
+        DefaultThreads() = threads;
+    }
+
+    static ThreadPool & Shared() {
+        static ThreadPool pool(DefaultThreads());
+        return pool;
+    }
+
+    /// index of the calling pool thread, -1 if not called from a pool thread
+    static int WorkerIndex() {
+        return CurrentWorker();
+    }
+
+    explicit ThreadPool(int threads) : mStop(false) {
+        if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+        if (threads <= 0) threads = 1;
+        for (int i = 0; i < threads; ++i) {
+            mWorkers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mStop = true;
+        }
+        mCond.notify_all();
+        for (auto & t : mWorkers) t.join();
+    }
+
+    int Size() const { return (int)mWorkers.size(); }
+
+    template <typename F>
+    auto Submit(F && f) -> std::future<decltype(f())> {
+        typedef decltype(f()) R;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        auto future = task->get_future();
+        Enqueue([task]() { (*task)(); });
+        return future;
+    }
+
+    /// run `fn(index, worker)' for index in [0, count), blocks until all done,
+    /// first exception thrown by any task is rethrown to the caller.
+    /// runs inline when called from a pool thread, so nesting never dead-locks.
+    void ParallelFor(int count, const std::function<void(int index, int worker)> & fn) {
+        if (count <= 0) return;
+        if (CurrentWorker() >= 0 || Size() == 1 || count == 1) {
+            int worker = std::max(CurrentWorker(), 0);
+            for (int i = 0; i < count; ++i) fn(i, worker);
+            return;
+        }
+
+        struct State {
+            std::atomic<int> next;
+            std::atomic<int> running;
+            std::mutex lock;
+            std::condition_variable done;
+            std::exception_ptr error;
+        };
+        auto st = std::make_shared<State>();
+        st->next = 0;
+        int runners = std::min(count, Size());
+        st->running = runners;
+
+        for (int r = 0; r < runners; ++r) {
+            Enqueue([st, count, &fn]() {
+                for (int i; (i = st->next++) < count; ) {
+                    try {
+                        fn(i, CurrentWorker());
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(st->lock);
+                        if (!st->error) st->error = std::current_exception();
+                        st->next = count;
+                    }
+                }
+                std::lock_guard<std::mutex> lock(st->lock);
+                if (--st->running == 0) st->done.notify_all();
+            });
+        }
+
+        std::unique_lock<std::mutex> lock(st->lock);
+        st->done.wait(lock, [&]() { return st->running == 0; });
+        if (st->error) std::rethrow_exception(st->error);
+    }
+
+private:
+    static int & DefaultThreads() {
+        static int threads = 0;
+        return threads;
+    }
+
+    static int & CurrentWorker() {
+        static thread_local int worker = -1;
+        return worker;
+    }
+
+    void Enqueue(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mTasks.push_back(std::move(task));
+        }
+        mCond.notify_one();
+    }
+
+    void WorkerLoop(int index) {
+        CurrentWorker() = index;
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mLock);
+                mCond.wait(lock, [this]() { return mStop || !mTasks.empty(); });
+                if (mStop && mTasks.empty()) return;
+                task = std::move(mTasks.front());
+                mTasks.pop_front();
+            }
+            task();
+        }
+    }
+
+private:
+    std::vector<std::thread> mWorkers;
+    std::deque<std::function<void()>> mTasks;
+    std::mutex mLock;
+    std::condition_variable mCond;
+    bool mStop;
+};
+
+/// bounded blocking FIFO for producer/consumer pipelines
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : mCapacity(capacity), mClosed(false) {}
+
+    /// blocks while full, returns false if the queue has been closed
+    bool Push(T item) {
+        std::unique_lock<std::mutex> lock(mLock);
+        mNotFull.wait(lock, [this]() { return mClosed || mItems.size() < mCapacity; });
+        if (mClosed) return false;
+        mItems.push_back(std::move(item));
+        mNotEmpty.notify_one();
+        return true;
+    }
+
+    /// blocks while empty, returns false once the queue is closed & drained
+    bool Pop(T & item) {
+        std::unique_lock<std::mutex> lock(mLock);
+        mNotEmpty.wait(lock, [this]() { return mClosed || !mItems.empty(); });
+        if (mItems.empty()) return false;
+        item = std::move(mItems.front());
+        mItems.pop_front();
+        mNotFull.notify_one();
+        return true;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(mLock);
+        mClosed = true;
+        mNotEmpty.notify_all();
+        mNotFull.notify_all();
+    }
+
+private:
+    std::deque<T> mItems;
+    size_t mCapacity;
+    bool mClosed;
+    std::mutex mLock;
+    std::condition_variable mNotEmpty;
+    std::condition_variable mNotFull;
+};
+
+END_NS
+
+#endif /* threadpool_h */
@@ -0,0 +1,521 @@
+//
+//  tiffwriter.h
+//  OpticalImageProcessor
+//
+//  Created by Qiu PENG on 18/10/26.
+//
+
+#ifndef tiffwriter_h
+#define tiffwriter_h
+
+#include <ctype.h>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gdal_priv.h>
+#include <opencv2/core.hpp>
+
+#include "oipshared.h"
+#include "threadpool.h"
+
+BEGIN_NS(OIP)
+
+struct GdalDsDtor {
+    inline void operator()(GDALDataset * ds) { if (ds) GDALClose(ds); }
+};
+
+const int TIFF_WRITE_QUEUE_STRIPS = 2;     // strips queued for the writer thread, besides the one being written
+const int TIFF_WRITE_STRIP_ROWS = 4096;    // rows per queued strip when writing an image already in memory
+const int TIFF_DEF_TILE_SIZE = 512;
+
+/// GTiff layout & compression of written images
+struct TiffOptions {
+    std::string compress;   // NONE, LZW, DEFLATE or ZSTD
+    int predictor;          // 1: none, 2: horizontal differencing, only used with compression
+    int level;              // DEFLATE (1-12) / ZSTD (1-22) level, 0 for GDAL default
+    int tileSize;           // square tiles of this many px (multiple of 16), 0 writes strips
+    int threads;            // compression threads, 0 for `--threads'
+    bool cog;               // cloud optimized GeoTIFF with overviews, see `TiffWriter'
+    std::string interleave; // PIXEL or BAND (band sequential), COG output is always PIXEL
+    bool rgba;              // 4 bands as `cv::imwrite' writes CV_16UC4: PHOTOMETRIC=RGB + alpha, pixel interleaved,
+                            // channels 0-2 stored as bands 3-1 (BGRA -> RGBA), so `cv::imread' gives the channels back
+    bool rgb;               // PHOTOMETRIC=RGB over bands 1-3, further bands are extra samples, channels stored in order
+
+    TiffOptions() :
+    compress("LZW"), predictor(2), level(0), tileSize(TIFF_DEF_TILE_SIZE), threads(0), cog(false), interleave("PIXEL"),
+    rgba(false), rgb(false) {}
+
+    /// process-wide options set from command line
+    static TiffOptions & Global() {
+        static TiffOptions options;
+        return options;
+    }
+
+    static bool ParseCompress(const std::string & name, std::string & compress) {
+        std::string upper = name;
+        std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+        if (upper != "NONE" && upper != "LZW" && upper != "DEFLATE" && upper != "ZSTD") return false;
+        compress = upper;
+        return true;
+    }
+
+    static bool ParseInterleave(const std::string & name, std::string & interleave) {
+        std::string upper = name;
+        std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+        if (upper != "PIXEL" && upper != "BAND") return false;
+        interleave = upper;
+        return true;
+    }
+
+    /// GTiff creation options, to be destroyed by `CSLDestroy()'
+    char ** CreationOptions() const {
+        char ** options = CSLParseCommandLine("");
+        options = CSLSetNameValue(options, "INTERLEAVE", rgba ? "PIXEL" : interleave.c_str());
+        options = CSLSetNameValue(options, "BIGTIFF", "IF_SAFER");
+        options = SetPhotometric(options);
+        if (tileSize > 0) {
+            options = CSLSetNameValue(options, "TILED", "YES");
+            options = CSLSetNameValue(options, "BLOCKXSIZE", std::to_string(tileSize).c_str());
+            options = CSLSetNameValue(options, "BLOCKYSIZE", std::to_string(tileSize).c_str());
+        }
+        if (compress != "NONE") {
+            // GDAL compresses blocks on these threads and writes them out in order
+            options = CSLSetNameValue(options, "COMPRESS", compress.c_str());
+            options = CSLSetNameValue(options, "PREDICTOR", std::to_string(predictor).c_str());
+            options = CSLSetNameValue(options, "NUM_THREADS", std::to_string(CompressThreads()).c_str());
+            if (level > 0 && compress == "DEFLATE") options = CSLSetNameValue(options, "ZLEVEL", std::to_string(level).c_str());
+            if (level > 0 && compress == "ZSTD") options = CSLSetNameValue(options, "ZSTD_LEVEL", std::to_string(level).c_str());
+        }
+        return options;
+    }
+
+    /// tiled GTiff holding full resolution & overviews of COG output until it is laid out, compressed with the
+    /// cheapest codec (ZSTD level 1 if ZSTD is configured, LZW otherwise) as it is decoded again right away
+    char ** CogStagingOptions() const {
+        int tile = TileSizeForCog();
+        char ** options = CSLParseCommandLine("");
+        options = CSLSetNameValue(options, "INTERLEAVE", "PIXEL");
+        options = CSLSetNameValue(options, "BIGTIFF", "IF_SAFER");
+        options = SetPhotometric(options);
+        options = CSLSetNameValue(options, "TILED", "YES");
+        options = CSLSetNameValue(options, "BLOCKXSIZE", std::to_string(tile).c_str());
+        options = CSLSetNameValue(options, "BLOCKYSIZE", std::to_string(tile).c_str());
+        options = CSLSetNameValue(options, "COMPRESS", compress == "ZSTD" ? "ZSTD" : "LZW");
+        if (compress == "ZSTD") options = CSLSetNameValue(options, "ZSTD_LEVEL", "1");
+        options = CSLSetNameValue(options, "PREDICTOR", std::to_string(predictor).c_str());
+        options = CSLSetNameValue(options, "NUM_THREADS", std::to_string(CompressThreads()).c_str());
+        return options;
+    }
+
+    /// COG driver creation options, overviews of the source are copied as they are
+    char ** CogOptions() const {
+        char ** options = CSLParseCommandLine("");
+        options = CSLSetNameValue(options, "BIGTIFF", "IF_SAFER");
+        options = CSLSetNameValue(options, "BLOCKSIZE", std::to_string(TileSizeForCog()).c_str());
+        options = CSLSetNameValue(options, "OVERVIEWS", "FORCE_USE_EXISTING");
+        options = CSLSetNameValue(options, "COMPRESS", compress.c_str());
+        if (compress != "NONE") {
+            options = CSLSetNameValue(options, "PREDICTOR", predictor > 1 ? "YES" : "NO");
+            options = CSLSetNameValue(options, "NUM_THREADS", std::to_string(CompressThreads()).c_str());
+            if (level > 0) options = CSLSetNameValue(options, "LEVEL", std::to_string(level).c_str());
+        }
+        return options;
+    }
+
+    /// PHOTOMETRIC=RGB for `rgb' output, with an unassociated alpha band (what `cv::imwrite' writes) for `rgba'
+    char ** SetPhotometric(char ** options) const {
+        if (!rgba && !rgb) return options;
+        options = CSLSetNameValue(options, "PHOTOMETRIC", "RGB");
+        return rgba ? CSLSetNameValue(options, "ALPHA", "YES") : options;
+    }
+
+    /// compression threads: `threads', or those of the shared pool
+    int CompressThreads() const {
+        return threads > 0 ? threads : ThreadPool::Shared().Size();
+    }
+
+    /// dataset band (1-based) of each channel of written strips
+    std::vector<int> BandMap(int bands) const {
+        std::vector<int> map(bands);
+        for (int c = 0; c < bands; ++c) map[c] = c + 1;
+        if (rgba) std::swap(map[0], map[2]);
+        return map;
+    }
+
+    /// COG is always tiled
+    int TileSizeForCog() const {
+        return tileSize > 0 ? tileSize : TIFF_DEF_TILE_SIZE;
+    }
+
+    std::string Describe() const {
+        std::string layout = tileSize > 0 ? xs("%dx%d tiles", tileSize, tileSize).s : std::string("strips");
+        if (cog) layout = xs("COG, %dx%d tiles", TileSizeForCog(), TileSizeForCog()).s;
+        if (rgba) layout += ", RGBA";
+        else if (rgb) layout += ", RGB";
+        if (compress == "NONE") return layout + ", uncompressed";
+        return layout + ", " + compress + (predictor > 1 ? " + predictor" : "");
+    }
+};
+
+/// reduced resolution levels (2x2 average, each half the size of the previous one, rounded up like GDAL
+/// overviews) of a pixel-interleaved uint16 image whose rows are added in order. every level keeps one row
+/// waiting for its pair and a block of finished rows, which is written into the dataset's overview as
+/// soon as it is full: overviews are complete when the last row is added, without reading the image back.
+class OverviewPyramid {
+public:
+    /// channel c of the image goes to band `bandMap[c]' (1-based) of `ds'
+    OverviewPyramid(GDALDataset * ds, int cols, int rows, int bands, int levels, int blockRows, const std::vector<int> & bandMap)
+    : mDataset(ds), mBands(bands), mBandMap(bandMap), mNextRow(0), mRows(rows) {
+        for (int l = 0; l < levels; ++l) {
+            Level level;
+            level.cols = ((l == 0 ? cols : mLevels.back().cols) + 1) / 2;
+            level.rows = ((l == 0 ? rows : mLevels.back().rows) + 1) / 2;
+            level.pending.resize((size_t)(l == 0 ? cols : mLevels.back().cols) * bands);
+            level.hasPending = false;
+            level.block.create(std::min(blockRows, level.rows), level.cols, CV_16UC(bands));
+            level.blockFill = 0;
+            level.blockRow = 0;
+            mLevels.push_back(level);
+        }
+    }
+
+    /// levels above full resolution until the coarsest fits in a `tileSize' tile
+    static int LevelsFor(int cols, int rows, int tileSize) {
+        int levels = 0;
+        for (int size = std::max(cols, rows); size > tileSize; size = (size + 1) / 2) levels++;
+        return levels;
+    }
+
+    int Levels() const { return (int)mLevels.size(); }
+
+    /// full resolution rows [row, row + data.rows), right after the previously added ones
+    void Add(const cv::Mat & data, int row) {
+        if (row != mNextRow) {
+            throw std::logic_error(xs("OverviewPyramid: rows should be added in order, row %d expected, got %d", mNextRow, row).s);
+        }
+        for (int y = 0; y < data.rows && !mLevels.empty(); ++y) Push(0, data.ptr<uint16_t>(y));
+        mNextRow += data.rows;
+    }
+
+    /// reduce rows left unpaired by an odd row count and write the last blocks
+    void Finish() {
+        if (mNextRow != mRows) {
+            throw std::logic_error(xs("OverviewPyramid: %d of %d rows added", mNextRow, mRows).s);
+        }
+        for (int l = 0; l < (int)mLevels.size(); ++l) {
+            Level & level = mLevels[l];
+            if (level.hasPending) {
+                level.hasPending = false;
+                Emit(l, Reduce(level, level.pending.data(), NULL));
+            }
+            WriteBlock(l);
+        }
+    }
+
+private:
+    struct Level {
+        int cols;
+        int rows;
+        std::vector<uint16_t> pending;  // row of the finer level waiting for its pair
+        bool hasPending;
+        cv::Mat block;                  // finished rows [blockRow, blockRow + blockFill)
+        int blockFill;
+        int blockRow;
+    };
+
+    /// a row of the finer level into level `l'
+    void Push(int l, const uint16_t * row) {
+        Level & level = mLevels[l];
+        if (!level.hasPending) {
+            std::copy(row, row + level.pending.size(), level.pending.begin());
+            level.hasPending = true;
+            return;
+        }
+        level.hasPending = false;
+        Emit(l, Reduce(level, level.pending.data(), row));
+    }
+
+    /// rounded average of 2x2 (fewer at the right & bottom borders) finer pixels into the next block row
+    const uint16_t * Reduce(Level & level, const uint16_t * a, const uint16_t * b) {
+        uint16_t * out = level.block.ptr<uint16_t>(level.blockFill);
+        int fineCols = (int)(level.pending.size() / mBands);
+        for (int x = 0; x < level.cols; ++x) {
+            int x0 = 2 * x, x1 = std::min(2 * x + 1, fineCols - 1);
+            int n = (x1 > x0 ? 2 : 1) * (b ? 2 : 1);
+            for (int c = 0; c < mBands; ++c) {
+                uint32_t sum = a[x0 * mBands + c] + (x1 > x0 ? a[x1 * mBands + c] : 0);
+                if (b) sum += b[x0 * mBands + c] + (x1 > x0 ? b[x1 * mBands + c] : 0);
+                out[x * mBands + c] = (uint16_t)((sum + n / 2) / n);
+            }
+        }
+        return out;
+    }
+
+    /// count the reduced row in its block, pass it on to the next level
+    void Emit(int l, const uint16_t * row) {
+        Level & level = mLevels[l];
+        level.blockFill++;
+        if (l + 1 < (int)mLevels.size()) Push(l + 1, row);
+        if (level.blockFill == level.block.rows) WriteBlock(l);
+    }
+
+    void WriteBlock(int l) {
+        Level & level = mLevels[l];
+        if (level.blockFill == 0) return;
+        for (int c = 0; c < mBands; ++c) {
+            GDALRasterBand * ovr = mDataset->GetRasterBand(mBandMap[c])->GetOverview(l);
+            if (ovr == NULL || ovr->RasterIO(GF_Write, 0, level.blockRow, level.cols, level.blockFill,
+                                             (uint16_t *)level.block.data + c, level.cols, level.blockFill, GDT_UInt16,
+                                             level.block.elemSize(), level.block.step[0]) == CE_Failure) {
+                throw std::runtime_error(xs("write overview %d of band #%d failed at row %d: %s",
+                                            l + 1, c + 1, level.blockRow, CPLGetLastErrorMsg()).s);
+            }
+        }
+        level.blockRow += level.blockFill;
+        level.blockFill = 0;
+    }
+
+private:
+    GDALDataset * mDataset;
+    int mBands;
+    std::vector<int> mBandMap;
+    int mNextRow;
+    int mRows;
+    std::vector<Level> mLevels;
+};
+
+/// GTiff output written strip by strip on a writer thread while the caller produces the next strips:
+/// `Write()' queues a pixel-interleaved uint16 strip (CV_16UC<bands>, shared, not copied), blocks only while
+/// `queueStrips' strips are pending, so memory is a few strips instead of the whole image.
+/// consecutive strips are re-cut at block (tile / strip) row boundaries, so no partially filled block is ever
+/// compressed & rewritten; strips may still come in any row order but must not overlap.
+/// `Close()' reports raw bytes, compression ratio & throughput. not thread safe: one producer thread.
+/// COG output (`TiffOptions::cog', strips must then come in row order) takes two passes: strips go to a tiled
+/// staging GTiff next to the output (cheaply compressed, see `TiffOptions::CogStagingOptions()'), with empty
+/// overviews whose rows `OverviewPyramid' fills as strips are written. `Close()' then reads the staging file once
+/// more to lay it out as COG (GDAL COG driver, existing overviews copied, recompressed on `threads') and removes
+/// it: the image is never read back to build overviews.
+class TiffWriter {
+public:
+    TiffWriter(const std::string & filePath, int cols, int rows, int bands,
+               const TiffOptions & options = TiffOptions::Global(), int queueStrips = TIFF_WRITE_QUEUE_STRIPS)
+    : mFilePath(filePath), mCols(cols), mRows(rows), mBands(bands), mOptions(options), mBlockRows(1),
+      mQueue(std::max(queueStrips, 1)), mAbort(false), mCarryRow(0), mBytes(0), mWriteTime(0.0) {
+        if (cols <= 0 || rows <= 0 || bands <= 0) throw std::invalid_argument("TiffWriter: invalid image size");
+        if (options.rgba && bands != 4) throw std::invalid_argument("TiffWriter: RGBA output needs 4 bands");
+        mBandMap = options.BandMap(bands);
+
+        if (options.cog) mStagingPath = filePath + ".staging.tif";
+        const std::string & path = options.cog ? mStagingPath : filePath;
+        char ** co = options.cog ? options.CogStagingOptions() : options.CreationOptions();
+        GDALDriver * drv = GetGDALDriverManager()->GetDriverByName("GTiff");
+        mDataset = drv->Create(path.c_str(), cols, rows, bands, GDT_UInt16, co);
+        CSLDestroy(co);
+        if (mDataset.is_null()) {
+            throw std::runtime_error(xs("create TIFF file [%s] failed: %s", path.c_str(), CPLGetLastErrorMsg()).s);
+        }
+        if (options.rgba) {
+            // also carried over by the COG driver, which has no PHOTOMETRIC option
+            const GDALColorInterp interps[] = { GCI_RedBand, GCI_GreenBand, GCI_BlueBand, GCI_AlphaBand };
+            for (int b = 0; b < bands; ++b) mDataset->GetRasterBand(b + 1)->SetColorInterpretation(interps[b]);
+        }
+        int blockCols = 0;
+        mDataset->GetRasterBand(1)->GetBlockSize(&blockCols, &mBlockRows);
+        mBlockRows = std::max(mBlockRows, 1);
+        if (options.cog) {
+            int levels = OverviewPyramid::LevelsFor(cols, rows, options.TileSizeForCog());
+            std::vector<int> factors;
+            for (int l = 0; l < levels; ++l) factors.push_back(2 << l);
+            // `NONE' only allocates the overviews, their rows are written by the pyramid
+            if (levels > 0 && mDataset->BuildOverviews("NONE", levels, factors.data(), 0, NULL, NULL, NULL) == CE_Failure) {
+                throw std::runtime_error(xs("create overviews of TIFF file [%s] failed: %s", path.c_str(), CPLGetLastErrorMsg()).s);
+            }
+            mPyramid.reset(new OverviewPyramid(mDataset.get(), cols, rows, bands, levels, mBlockRows, mBandMap));
+        }
+        OLOG("Writing TIFF file [%s] (%d x %d x %d, %s) ...", filePath.c_str(), cols, rows, bands, options.Describe().c_str());
+        mWriter = std::thread(&TiffWriter::WriterLoop, this);
+    }
+
+    /// abandons queued strips if not closed, e.g. when unwinding on error
+    ~TiffWriter() {
+        if (!mWriter.joinable()) return;
+        mAbort = true;
+        mQueue.Close();
+        mWriter.join();
+        if (mStagingPath.length() > 0) {
+            mDataset.attach(NULL);
+            VSIUnlink(mStagingPath.c_str());
+        }
+    }
+
+    const std::string & FilePath() const { return mFilePath; }
+
+    /// rows per TIFF block, strips of a multiple of it are written without re-cutting
+    int BlockRows() const { return mBlockRows; }
+
+    /// queue `strip' as image rows [row, row + strip.rows), rethrows a failed write of a previous strip
+    void Write(const cv::Mat & strip, int row) {
+        if (strip.depth() != CV_16U || strip.channels() != mBands || strip.cols != mCols
+            || row < 0 || row + strip.rows > mRows) {
+            throw std::invalid_argument(xs("TiffWriter: strip of %d x %d x %d at row %d does not fit %d x %d x %d image",
+                                           strip.cols, strip.rows, strip.channels(), row, mCols, mRows, mBands).s);
+        }
+        if (!mWriter.joinable()) throw std::logic_error("TiffWriter: writing to a closed writer");
+        if (!mQueue.Push({ strip, row })) {
+            if (mError) std::rethrow_exception(mError);
+            throw std::logic_error("TiffWriter: writer stopped");
+        }
+    }
+
+    /// write all queued strips and close the file, rethrows the first failed write (COG output: after
+    /// removing the staging file & the partial output)
+    void Close() {
+        if (!mWriter.joinable()) return;
+        mQueue.Close();
+        mWriter.join();
+        stop_watch sw;
+        try {
+            if (mError) std::rethrow_exception(mError);
+            // flushing on close compresses & writes the remaining blocks
+            if (mPyramid) mPyramid->Finish();
+            mDataset.attach(NULL);
+            if (mOptions.cog) WriteCog();
+        } catch (...) {
+            // the destructor won't clean up a joined writer: leave neither the staging file nor a partial COG
+            mDataset.attach(NULL);
+            if (mStagingPath.length() > 0) {
+                VSIUnlink(mStagingPath.c_str());
+                VSIUnlink(mFilePath.c_str());
+            }
+            throw;
+        }
+        mWriteTime += sw.tick().ellapsed;
+        auto es = mElapsed.tick().ellapsed;
+
+        size_t fileBytes = std::filesystem::file_size(mFilePath);
+        OLOG("%s bytes written to TIFF file [%s] as %s bytes (compression ratio %.2f) in %s seconds (%s MBps), "
+             "write busy time %s seconds.",
+             comma_sep(mBytes).sep(),
+             mFilePath.c_str(),
+             comma_sep(fileBytes).sep(),
+             (double)mBytes / std::max(fileBytes, (size_t)1),
+             comma_sep(es).sep(),
+             comma_sep(mBytes/std::max(es, 1e-9)/1024.0/1024.0).sep(),
+             comma_sep(mWriteTime).sep());
+    }
+
+private:
+    struct Strip {
+        cv::Mat data;
+        int row;
+    };
+
+    void WriterLoop() {
+        try {
+            Strip s;
+            while (!mAbort && mQueue.Pop(s)) {
+                stop_watch sw;
+                WriteBlockAligned(s);
+                mWriteTime += sw.tick().ellapsed;
+                mBytes += s.data.elemSize() * s.data.total();
+            }
+            if (!mAbort && !mCarry.empty()) WriteRows(mCarry, mCarryRow);
+        } catch (...) {
+            mError = std::current_exception();
+            mQueue.Close();
+        }
+    }
+
+    /// rows up to the last block boundary are written, the rest is carried over to be completed by the next strip
+    void WriteBlockAligned(const Strip & strip) {
+        cv::Mat data = strip.data;
+        int row = strip.row;
+        if (!mCarry.empty()) {
+            if (row != mCarryRow + mCarry.rows) {
+                WriteRows(mCarry, mCarryRow);
+                mCarry.release();
+            } else {
+                int head = std::min(mBlockRows - mCarry.rows, data.rows);
+                cv::Mat joined(mCarry.rows + head, mCols, mCarry.type());
+                mCarry.copyTo(joined.rowRange(0, mCarry.rows));
+                data.rowRange(0, head).copyTo(joined.rowRange(mCarry.rows, joined.rows));
+                data = data.rowRange(head, data.rows);
+                row += head;
+                mCarry = joined;
+                if (mCarry.rows < mBlockRows && mCarryRow + mCarry.rows < mRows) return;
+                WriteRows(mCarry, mCarryRow);
+                mCarry.release();
+            }
+        }
+        if (data.rows == 0) return;
+        int end = row + data.rows;
+        int cut = end == mRows ? end : std::max(row, end / mBlockRows * mBlockRows);
+        if (cut > row) WriteRows(data.rowRange(0, cut - row), row);
+        if (cut < end) {
+            mCarry = data.rowRange(cut - row, data.rows);
+            mCarryRow = cut;
+        }
+    }
+
+    void WriteRows(const cv::Mat & data, int row) {
+        if (mDataset->RasterIO(GF_Write, 0, row, mCols, data.rows,
+                               data.data, mCols, data.rows, GDT_UInt16, mBands, mBandMap.data(),
+                               data.elemSize(), data.step[0], data.elemSize1()) == CE_Failure) {
+            throw std::runtime_error(xs("write TIFF file [%s] failed at row %d: %s",
+                                        mFilePath.c_str(), row, CPLGetLastErrorMsg()).s);
+        }
+        if (mPyramid) mPyramid->Add(data, row);
+    }
+
+    /// staging file with overviews -> COG output, staging file removed
+    void WriteCog() {
+        OLOG("Laying out COG file [%s] (%d overview level(s)) ...", mFilePath.c_str(), mPyramid->Levels());
+        scoped_ptr<GDALDataset, GdalDsDtor> staging = (GDALDataset *)GDALOpen(mStagingPath.c_str(), GA_ReadOnly);
+        if (staging.is_null()) {
+            throw std::runtime_error(xs("open staging file [%s] failed: %s", mStagingPath.c_str(), CPLGetLastErrorMsg()).s);
+        }
+        char ** co = mOptions.CogOptions();
+        GDALDriver * drv = GetGDALDriverManager()->GetDriverByName("COG");
+        scoped_ptr<GDALDataset, GdalDsDtor> cog = drv == NULL ? NULL :
+            drv->CreateCopy(mFilePath.c_str(), staging, FALSE, co, NULL, NULL);
+        CSLDestroy(co);
+        if (cog.is_null()) {
+            throw std::runtime_error(xs("write COG file [%s] failed: %s", mFilePath.c_str(), CPLGetLastErrorMsg()).s);
+        }
+        cog.attach(NULL);
+        staging.attach(NULL);
+        VSIUnlink(mStagingPath.c_str());
+    }
+
+private:
+    const std::string mFilePath;
+    const int mCols;
+    const int mRows;
+    const int mBands;
+    const TiffOptions mOptions;
+    std::vector<int> mBandMap;  // dataset band of each strip channel, see `TiffOptions::rgba'
+    std::string mStagingPath;   // COG output only
+    int mBlockRows;
+    scoped_ptr<GDALDataset, GdalDsDtor> mDataset;
+    BoundedQueue<Strip> mQueue;
+    std::thread mWriter;
+    std::atomic<bool> mAbort;
+    std::exception_ptr mError;
+    std::unique_ptr<OverviewPyramid> mPyramid;
+    cv::Mat mCarry;         // rows of an incomplete block, writer thread only
+    int mCarryRow;
+    size_t mBytes;
+    double mWriteTime;
+    stop_watch mElapsed;
+};
+
+END_NS
+
+#endif /* tiffwriter_h */
@@ -0,0 +1,623 @@
+//
+//  warp.h
+//  OpticalImageProcessor
+//
+//  Created by Qiu PENG on 18/10/26.
+//
+
+#ifndef warp_h
+#define warp_h
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "oipshared.h"
+#include "simd.h"
+#include "testimage.h"
+#include "threadpool.h"
+
+BEGIN_NS(OIP)
+
+const int WARP_TAB_BITS = 5;                        // sub-pixel positions are quantized to 1/32 px, as cv::remap does
+const int WARP_TAB_SIZE = 1 << WARP_TAB_BITS;
+const int WARP_MAX_TAPS = 8;                        // neighbourhood width of the widest kernel (Lanczos)
+const int WARP_BLOCK_ROWS = 64;                     // output rows per parallel task
+const int WARP_REMAP_CHUNK_ROWS = 1024;             // rows of the fixed-point maps reused by `ColumnShiftRemap'
+
+enum WarpEngine {
+    WARP_ENGINE_ANALYTIC = 0,   // `ColumnShiftWarp', source coordinates computed from per-column tables
+    WARP_ENGINE_REMAP,          // `ColumnShiftRemap', cv::remap with fixed-point map chunks
+};
+
+/// interpolation quality tiers, valued after the taps of the separable neighbourhood
+enum WarpInterp {
+    WARP_INTERP_NEAREST = 1,    // nearest neighbour
+    WARP_INTERP_LINEAR  = 2,    // bilinear, 2x2 neighbourhood
+    WARP_INTERP_CUBIC   = 4,    // bicubic (A = -0.75), 4x4 neighbourhood
+    WARP_INTERP_LANCZOS = 8,    // Lanczos (a = 4), 8x8 neighbourhood
+};
+
+struct WarpOptions {
+    WarpEngine engine;          // inter-band alignment
+    WarpEngine stitchEngine;    // PAN2 pre-stitch, `SectionaryRemap()' unless opted into the analytic kernels
+    WarpInterp quality;         // interpolation of alignment, pre-stitch & MSS upscaling for correlation
+
+    WarpOptions() : engine(WARP_ENGINE_ANALYTIC), stitchEngine(WARP_ENGINE_REMAP), quality(WARP_INTERP_CUBIC) {}
+
+    /// process-wide options set from command line
+    static WarpOptions & Global() {
+        static WarpOptions options;
+        return options;
+    }
+
+    static bool ParseEngine(const std::string & name, WarpEngine & engine) {
+        if (name == "analytic") { engine = WARP_ENGINE_ANALYTIC; return true; }
+        if (name == "remap")    { engine = WARP_ENGINE_REMAP;    return true; }
+        return false;
+    }
+
+    static const char * EngineName(WarpEngine engine) {
+        return engine == WARP_ENGINE_REMAP ? "remap" : "analytic";
+    }
+
+    static bool ParseQuality(const std::string & name, WarpInterp & quality) {
+        if (name == "nearest")  { quality = WARP_INTERP_NEAREST; return true; }
+        if (name == "bilinear") { quality = WARP_INTERP_LINEAR;  return true; }
+        if (name == "cubic")    { quality = WARP_INTERP_CUBIC;   return true; }
+        if (name == "lanczos")  { quality = WARP_INTERP_LANCZOS; return true; }
+        return false;
+    }
+
+    static const char * QualityName(WarpInterp quality) {
+        switch (quality) {
+            case WARP_INTERP_NEAREST: return "nearest";
+            case WARP_INTERP_LINEAR:  return "bilinear";
+            case WARP_INTERP_LANCZOS: return "lanczos";
+            default:                  return "cubic";
+        }
+    }
+
+    /// the OpenCV interpolation flag of a tier
+    static int CvInterpolation(WarpInterp quality) {
+        switch (quality) {
+            case WARP_INTERP_NEAREST: return cv::INTER_NEAREST;
+            case WARP_INTERP_LINEAR:  return cv::INTER_LINEAR;
+            case WARP_INTERP_LANCZOS: return cv::INTER_LANCZOS4;
+            default:                  return cv::INTER_CUBIC;
+        }
+    }
+};
+
+/// source coordinates of output pixel (x, y): srcX = mapX[x], srcY = y + shiftY[x]
+struct ColumnShift {
+    std::vector<double> mapX;
+    std::vector<double> shiftY;
+
+    int Cols() const { return (int)mapX.size(); }
+
+    /// inter-band model: polynomials of PAN column x' = x * scale give PAN pixel shifts,
+    /// mapX(x) = (x' + dx(x')) / scale, shiftY(x) = dy(x') / scale
+    static ColumnShift FromPolynomial(int cols, const double coeffX[2], const double coeffY[3], int scale) {
+        ColumnShift model;
+        model.mapX.resize(cols);
+        model.shiftY.resize(cols);
+        for (int x = 0; x < cols; ++x) {
+            double xx = (double)x * scale;
+            model.mapX[x] = (coeffX[1] * xx + coeffX[0] + xx) / scale;
+            model.shiftY[x] = (coeffY[2] * xx * xx + coeffY[1] * xx + coeffY[0]) / scale;
+        }
+        return model;
+    }
+};
+
+/// nearest, bilinear, bicubic (A = -0.75) or Lanczos (a = 4) warp, zero outside the source, of a uint16 image
+/// whose source coordinates are
+///     srcX = mapX(x), srcY = y + shiftY(x)
+/// i.e. the inter-band alignment model, where both only depend on the output column. all per-pixel work
+/// is table driven: integer source offsets & N+N separable weights per column, so memory is O(width).
+/// equivalent to `cv::remap(INTER_NEAREST / LINEAR / CUBIC / LANCZOS4, BORDER_CONSTANT)' with the same maps,
+/// up to float rounding.
+/// SSE4.1 / AVX2 / AVX-512 paths (4 / 8 / 16 columns at a time) evaluate the same float expressions in the same
+/// order as the scalar path, so all levels give bit-exact output (see `SelfTest()').
+class ColumnShiftWarp {
+public:
+    explicit ColumnShiftWarp(const ColumnShift & model, WarpInterp interp = WARP_INTERP_CUBIC)
+    : mCols(model.Cols()), mTaps((int)interp), mSrcX(model.Cols()), mSrcY(model.Cols()) {
+        if (model.mapX.size() != model.shiftY.size()) throw std::invalid_argument("ColumnShiftWarp: mapX & shiftY size mismatch");
+        const float (* table)[WARP_MAX_TAPS] = WeightTable(interp);
+        for (int k = 0; k < mTaps; ++k) {
+            mWX[k].resize(mCols);
+            mWY[k].resize(mCols);
+        }
+        int origin = mTaps / 2 - 1;     // neighbourhood starts 1 (bicubic) or 3 (Lanczos) px before the sample
+        for (int x = 0; x < mCols; ++x) {
+            if (mTaps == WARP_INTERP_NEAREST) {
+                // rounded like cv::remap, without the 1/32 px quantization
+                mSrcX[x] = (int)lrint(model.mapX[x]);
+                mSrcY[x] = (int)lrint(model.shiftY[x]);
+                mWX[0][x] = mWY[0][x] = 1.f;
+                continue;
+            }
+            int sx = (int)lrint(model.mapX[x] * WARP_TAB_SIZE);
+            int sy = (int)lrint(model.shiftY[x] * WARP_TAB_SIZE);
+            mSrcX[x] = (sx >> WARP_TAB_BITS) - origin;
+            mSrcY[x] = (sy >> WARP_TAB_BITS) - origin;
+            for (int k = 0; k < mTaps; ++k) {
+                mWX[k][x] = table[sx & (WARP_TAB_SIZE - 1)][k];
+                mWY[k][x] = table[sy & (WARP_TAB_SIZE - 1)][k];
+            }
+        }
+    }
+
+    int Cols() const { return mCols; }
+    WarpInterp Interp() const { return (WarpInterp)mTaps; }
+
+    /// source rows [s, e) of a `srcRows' high source that output rows [y0, y1) read, i.e. the rolling window
+    /// a streaming pass has to keep; rows outside it contribute nothing, so `Apply()' on just the window
+    /// (origin moved by `s') gives the same output
+    void SourceWindow(int y0, int y1, int srcRows, int & s, int & e) const {
+        auto range = std::minmax_element(mSrcY.begin(), mSrcY.end());
+        s = std::max(0, std::min(y0 + *range.first, srcRows));
+        e = std::max(s, std::min(y1 - 1 + *range.second + mTaps, srcRows));
+    }
+
+    /// output rows [y0, y1) of `Cols()' pixels, source is `srcRows' x `srcCols' with the same row origin;
+    /// output pixels are `dstStep' elements apart, so a band can be written straight into its channel
+    /// of an interleaved multi-channel image (`dstStep' = channels, `dst' at the channel's first element)
+    void Apply(const uint16_t * src, size_t srcStride, int srcRows, int srcCols,
+               uint16_t * dst, size_t dstStride, int dstStep, int y0, int y1,
+               SimdLevel level = Simd::Level()) const {
+        switch (mTaps) {
+            case WARP_INTERP_NEAREST: ApplyRows<1>(src, srcStride, srcRows, srcCols, dst, dstStride, dstStep, y0, y1, level); break;
+            case WARP_INTERP_LINEAR:  ApplyRows<2>(src, srcStride, srcRows, srcCols, dst, dstStride, dstStep, y0, y1, level); break;
+            case WARP_INTERP_LANCZOS: ApplyRows<8>(src, srcStride, srcRows, srcCols, dst, dstStride, dstStep, y0, y1, level); break;
+            default:                  ApplyRows<4>(src, srcStride, srcRows, srcCols, dst, dstStride, dstStep, y0, y1, level); break;
+        }
+    }
+
+    /// reference-equivalence suite of all kernels: scalar path against double precision evaluation of the
+    /// same model (1 DN for float rounding), then every SIMD level up to `Simd::Level()' against the scalar path,
+    /// contiguous & channel-strided output, which must be bit-exact; throws on any larger deviation
+    static void SelfTest(int rows = 96, int cols = 1003) {
+        cv::Mat texture = TestImage::SyntheticTexture(rows, cols, CV_16UC1, 0x3C6EF372, 2000, 1500, 23);
+        std::vector<uint16_t> src((const uint16_t *)texture.data, (const uint16_t *)texture.data + (size_t)rows * cols);
+        // saturated highlights & black pixels, so that clamping of overshoot is covered as well
+        for (size_t i = 0; i < src.size(); i += 37) src[i] = (i / 37) % 2 ? 65535 : 0;
+        const double coeffX[2] = { 2.7, -0.0004 };
+        const double coeffY[3] = { -11.3, 0.0052, 1.1e-7 };
+        ColumnShift model = ColumnShift::FromPolynomial(cols, coeffX, coeffY, 4);
+
+        for (WarpInterp interp : { WARP_INTERP_NEAREST, WARP_INTERP_LINEAR, WARP_INTERP_CUBIC, WARP_INTERP_LANCZOS }) {
+            ColumnShiftWarp warp(model, interp);
+            std::vector<uint16_t> expect(src.size());
+            warp.Apply(src.data(), cols, rows, cols, expect.data(), cols, 1, 0, rows, SIMD_SCALAR);
+            int maxRef = 0;
+            for (int y = 0; y < rows; ++y) {
+                for (int x = 0; x < cols; ++x) {
+                    maxRef = std::max(maxRef, abs((int)expect[y * cols + x] - warp.Reference(src.data(), cols, rows, cols, x, y)));
+                }
+            }
+            OLOG("ColumnShiftWarp [%s, scalar]: max deviation from double precision %d DN.", WarpOptions::QualityName(interp), maxRef);
+            if (maxRef > 1) {
+                throw std::runtime_error(xs("ColumnShiftWarp deviates from double precision %s interpolation", WarpOptions::QualityName(interp)).s);
+            }
+
+            // contiguous output, and a single channel of 3-channel interleaved output
+            for (int l = SIMD_SSE41; l <= Simd::Level(); ++l) {
+                for (int step = 1; step <= 3; step += 2) {
+                    std::vector<uint16_t> actual(src.size() * step);
+                    warp.Apply(src.data(), cols, rows, cols, actual.data() + step / 2, (size_t)cols * step, step, 0, rows,
+                               (SimdLevel)l);
+                    size_t diff = 0;
+                    int maxDev = 0;
+                    for (size_t i = 0; i < src.size(); ++i) {
+                        int dev = abs((int)actual[i * step + step / 2] - expect[i]);
+                        diff += dev > 0;
+                        maxDev = std::max(maxDev, dev);
+                    }
+                    OLOG("ColumnShiftWarp [%s, %s, pixel step %d]: %s pixels compared, %s mismatch(es), max deviation %d DN.",
+                         WarpOptions::QualityName(interp), Simd::Name((SimdLevel)l), step,
+                         comma_sep(src.size()).sep(),
+                         comma_sep(diff).sep(),
+                         maxDev);
+                    if (diff > 0) {
+                        throw std::runtime_error(xs("ColumnShiftWarp [%s, %s] is not bit-exact with scalar path",
+                                                    WarpOptions::QualityName(interp), Simd::Name((SimdLevel)l)).s);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    /// separable weights of `cv::remap' at 1/32 px steps, first `interp' (= taps) of each row used
+    static const float (* WeightTable(WarpInterp interp))[WARP_MAX_TAPS] {
+        switch (interp) {
+            case WARP_INTERP_NEAREST:
+            case WARP_INTERP_LINEAR:
+            case WARP_INTERP_CUBIC:
+            case WARP_INTERP_LANCZOS:
+                break;
+            default:
+                throw std::invalid_argument("ColumnShiftWarp: unknown interpolation");
+        }
+        static float linear[WARP_TAB_SIZE][WARP_MAX_TAPS], cubic[WARP_TAB_SIZE][WARP_MAX_TAPS], lanczos[WARP_TAB_SIZE][WARP_MAX_TAPS];
+        static bool ready = [&]() {
+            const float A = -0.75f;
+            for (int i = 0; i < WARP_TAB_SIZE; ++i) {
+                float x = (float)i / WARP_TAB_SIZE;
+                linear[i][0] = 1.f - x;
+                linear[i][1] = x;
+
+                cubic[i][0] = ((A * (x + 1) - 5 * A) * (x + 1) + 8 * A) * (x + 1) - 4 * A;
+                cubic[i][1] = ((A + 2) * x - (A + 3)) * x * x + 1;
+                cubic[i][2] = ((A + 2) * (1 - x) - (A + 3)) * (1 - x) * (1 - x) + 1;
+                cubic[i][3] = 1.f - cubic[i][0] - cubic[i][1] - cubic[i][2];
+
+                // sinc(t) * sinc(t / 4) at t = x + 3 - k, normalized to unit sum
+                double w[WARP_MAX_TAPS], sum = 0.0;
+                for (int k = 0; k < WARP_MAX_TAPS; ++k) {
+                    double t = x + 3 - k;
+                    w[k] = fabs(t) < 1e-6 ? 1.0 : 4.0 * sin(M_PI * t) * sin(M_PI * t / 4) / (M_PI * M_PI * t * t);
+                    sum += w[k];
+                }
+                for (int k = 0; k < WARP_MAX_TAPS; ++k) lanczos[i][k] = (float)(w[k] / sum);
+            }
+            return true;
+        }();
+        (void)ready;
+        return interp == WARP_INTERP_LANCZOS ? lanczos : interp == WARP_INTERP_CUBIC ? cubic : linear;
+    }
+
+    static uint16_t Saturate(float v) {
+        long iv = lrintf(v);
+        return (uint16_t)std::max(0L, std::min(iv, 65535L));
+    }
+
+    template <int N>
+    void ApplyRows(const uint16_t * src, size_t srcStride, int srcRows, int srcCols,
+                   uint16_t * dst, size_t dstStride, int dstStep, int y0, int y1, SimdLevel level) const {
+        // `width'-column groups whose NxN neighbourhoods (& the pixel after an odd N) are inside the source for rows [lo, hi]
+        const int PAIRS = (N + 1) / 2;
+        int width = level >= SIMD_AVX512 ? 16 : level >= SIMD_AVX2 ? 8 : level >= SIMD_SSE41 ? 4 : 0;
+        int groups = width > 0 ? mCols / width : 0;
+        std::vector<int> lo(groups), hi(groups);
+        for (int g = 0; g < groups; ++g) {
+            int x0 = g * width;
+            lo[g] = INT32_MAX;
+            hi[g] = INT32_MIN;
+            bool inside = true;
+            for (int x = x0; x < x0 + width; ++x) inside = inside && mSrcX[x] >= 0 && mSrcX[x] + PAIRS * 2 - 1 < srcCols;
+            if (!inside) continue;
+            lo[g] = -mSrcY[x0];
+            hi[g] = srcRows - N - mSrcY[x0];
+            for (int x = x0 + 1; x < x0 + width; ++x) {
+                lo[g] = std::max(lo[g], -mSrcY[x]);
+                hi[g] = std::min(hi[g], srcRows - N - mSrcY[x]);
+            }
+        }
+
+        for (int y = y0; y < y1; ++y) {
+            uint16_t * d = dst + (size_t)(y - y0) * dstStride;
+            int x = 0;
+#if OIP_SIMD_X86
+            for (int g = 0; g < groups; ++g, x += width) {
+                if (y < lo[g] || y > hi[g]) {
+                    for (int i = x; i < x + width; ++i) d[(size_t)i * dstStep] = Pixel<N>(src, srcStride, srcRows, srcCols, i, y);
+                } else if (width == 16) {
+                    PixelsAVX512<N>(src, srcStride, x, y, d, dstStep);
+                } else if (width == 8) {
+                    PixelsAVX2<N>(src, srcStride, x, y, d, dstStep);
+                } else {
+                    PixelsSSE41<N>(src, srcStride, x, y, d, dstStep);
+                }
+            }
+#endif
+            for (; x < mCols; ++x) d[(size_t)x * dstStep] = Pixel<N>(src, srcStride, srcRows, srcCols, x, y);
+        }
+    }
+
+    /// source pixels outside the image are 0 (BORDER_CONSTANT); sums are accumulated left to right,
+    /// the order every SIMD path follows
+    template <int N>
+    uint16_t Pixel(const uint16_t * src, size_t stride, int rows, int cols, int x, int y) const {
+        int sx = mSrcX[x], sy = y + mSrcY[x];
+        float r[N];
+        for (int k = 0; k < N; ++k) {
+            float p[N] = {};
+            if (sy + k >= 0 && sy + k < rows) {
+                const uint16_t * s = src + (size_t)(sy + k) * stride;
+                for (int c = 0; c < N; ++c) {
+                    if (sx + c >= 0 && sx + c < cols) p[c] = s[sx + c];
+                }
+            }
+            r[k] = mWX[0][x] * p[0];
+            for (int c = 1; c < N; ++c) r[k] = r[k] + mWX[c][x] * p[c];
+        }
+        float sum = mWY[0][x] * r[0];
+        for (int k = 1; k < N; ++k) sum = sum + mWY[k][x] * r[k];
+        return Saturate(sum);
+    }
+
+    int Reference(const uint16_t * src, size_t stride, int rows, int cols, int x, int y) const {
+        double sum = 0.0;
+        for (int k = 0; k < mTaps; ++k) {
+            for (int c = 0; c < mTaps; ++c) {
+                int yy = y + mSrcY[x] + k, xx = mSrcX[x] + c;
+                if (yy >= 0 && yy < rows && xx >= 0 && xx < cols) {
+                    sum += (double)mWY[k][x] * mWX[c][x] * src[(size_t)yy * stride + xx];
+                }
+            }
+        }
+        return (int)std::max(0L, std::min(lrint(sum), 65535L));
+    }
+
+#if OIP_SIMD_X86
+    /// 4 output pixels: pixel pairs (sx + 2j, sx + 2j + 1) of each source row are loaded as 32-bit lanes,
+    /// stored `step' elements apart
+    template <int N>
+    OIP_TARGET("sse4.1")
+    void PixelsSSE41(const uint16_t * src, size_t stride, int x, int y, uint16_t * d, int step) const {
+        const uint16_t * s[4];
+        for (int i = 0; i < 4; ++i) s[i] = src + (size_t)(y + mSrcY[x + i]) * stride + mSrcX[x + i];
+        __m128i lowMask = _mm_set1_epi32(0xFFFF);
+        __m128 r[N];
+        for (int k = 0; k < N; ++k) {
+            __m128 p[N + 1];
+            for (int j = 0; j < (N + 1) / 2; ++j) {
+                int v[4];
+                for (int i = 0; i < 4; ++i) memcpy(v + i, s[i] + (size_t)k * stride + 2 * j, sizeof(int));
+                __m128i pair = _mm_setr_epi32(v[0], v[1], v[2], v[3]);
+                p[2 * j]     = _mm_cvtepi32_ps(_mm_and_si128(pair, lowMask));
+                p[2 * j + 1] = _mm_cvtepi32_ps(_mm_srli_epi32(pair, 16));
+            }
+            r[k] = _mm_mul_ps(_mm_loadu_ps(mWX[0].data() + x), p[0]);
+            for (int c = 1; c < N; ++c) r[k] = _mm_add_ps(r[k], _mm_mul_ps(_mm_loadu_ps(mWX[c].data() + x), p[c]));
+        }
+        __m128 sum = _mm_mul_ps(_mm_loadu_ps(mWY[0].data() + x), r[0]);
+        for (int k = 1; k < N; ++k) sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(mWY[k].data() + x), r[k]));
+        __m128i iv = _mm_cvtps_epi32(sum);
+        __m128i packed = _mm_packus_epi32(iv, iv);
+        if (step == 1) {
+            _mm_storel_epi64((__m128i *)(d + x), packed);
+            return;
+        }
+        alignas(16) uint16_t out[8];
+        _mm_store_si128((__m128i *)out, packed);
+        uint16_t * p = d + (size_t)x * step;
+        for (int i = 0; i < 4; ++i, p += step) *p = out[i];
+    }
+
+    /// 8 output pixels: per source row (N+1)/2 gathers of pixel pairs (sx, sx+1), (sx+2, sx+3) ...,
+    /// stored `step' elements apart
+    template <int N>
+    OIP_TARGET("avx2")
+    void PixelsAVX2(const uint16_t * src, size_t stride, int x, int y, uint16_t * d, int step) const {
+        const int * base = (const int *)(src + (size_t)y * stride);
+        __m256i idx = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(mSrcY.data() + x)),
+                                                          _mm256_set1_epi32((int)stride)),
+                                       _mm256_loadu_si256((const __m256i *)(mSrcX.data() + x)));
+        __m256i lowMask = _mm256_set1_epi32(0xFFFF);
+        __m256 r[N];
+        for (int k = 0; k < N; ++k) {
+            __m256 p[N + 1];
+            for (int j = 0; j < (N + 1) / 2; ++j) {
+                __m256i pair = _mm256_i32gather_epi32(base, _mm256_add_epi32(idx, _mm256_set1_epi32(2 * j)), 2);
+                p[2 * j]     = _mm256_cvtepi32_ps(_mm256_and_si256(pair, lowMask));
+                p[2 * j + 1] = _mm256_cvtepi32_ps(_mm256_srli_epi32(pair, 16));
+            }
+            r[k] = _mm256_mul_ps(_mm256_loadu_ps(mWX[0].data() + x), p[0]);
+            for (int c = 1; c < N; ++c) r[k] = _mm256_add_ps(r[k], _mm256_mul_ps(_mm256_loadu_ps(mWX[c].data() + x), p[c]));
+            idx = _mm256_add_epi32(idx, _mm256_set1_epi32((int)stride));
+        }
+        __m256 sum = _mm256_mul_ps(_mm256_loadu_ps(mWY[0].data() + x), r[0]);
+        for (int k = 1; k < N; ++k) sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(mWY[k].data() + x), r[k]));
+        __m256i iv = _mm256_cvtps_epi32(sum);
+        __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(iv), _mm256_extracti128_si256(iv, 1));
+        if (step == 1) {
+            _mm_storeu_si128((__m128i *)(d + x), packed);
+            return;
+        }
+        alignas(16) uint16_t out[8];
+        _mm_store_si128((__m128i *)out, packed);
+        uint16_t * p = d + (size_t)x * step;
+        for (int i = 0; i < 8; ++i, p += step) *p = out[i];
+    }
+
+    /// 16 output pixels, gathers as `PixelsAVX2()'; explicit rounding forms keep the compiler from contracting
+    /// products & sums into FMA (implied by AVX-512F), which would not be bit-exact with the scalar path
+    template <int N>
+    OIP_TARGET("avx512f,avx512bw")
+    void PixelsAVX512(const uint16_t * src, size_t stride, int x, int y, uint16_t * d, int step) const {
+        const int * base = (const int *)(src + (size_t)y * stride);
+        __m512i idx = _mm512_add_epi32(_mm512_mullo_epi32(_mm512_loadu_si512(mSrcY.data() + x), _mm512_set1_epi32((int)stride)),
+                                       _mm512_loadu_si512(mSrcX.data() + x));
+        __m512i lowMask = _mm512_set1_epi32(0xFFFF);
+        __m512 r[N];
+        for (int k = 0; k < N; ++k) {
+            __m512 p[N + 1];
+            for (int j = 0; j < (N + 1) / 2; ++j) {
+                __m512i pair = _mm512_i32gather_epi32(_mm512_add_epi32(idx, _mm512_set1_epi32(2 * j)), base, 2);
+                p[2 * j]     = _mm512_cvtepi32_ps(_mm512_and_si512(pair, lowMask));
+                p[2 * j + 1] = _mm512_cvtepi32_ps(_mm512_srli_epi32(pair, 16));
+            }
+            r[k] = _mm512_mul_round_ps(_mm512_loadu_ps(mWX[0].data() + x), p[0], _MM_FROUND_CUR_DIRECTION);
+            for (int c = 1; c < N; ++c) {
+                r[k] = _mm512_add_round_ps(r[k], _mm512_mul_round_ps(_mm512_loadu_ps(mWX[c].data() + x), p[c],
+                                                                     _MM_FROUND_CUR_DIRECTION),
+                                           _MM_FROUND_CUR_DIRECTION);
+            }
+            idx = _mm512_add_epi32(idx, _mm512_set1_epi32((int)stride));
+        }
+        __m512 sum = _mm512_mul_round_ps(_mm512_loadu_ps(mWY[0].data() + x), r[0], _MM_FROUND_CUR_DIRECTION);
+        for (int k = 1; k < N; ++k) {
+            sum = _mm512_add_round_ps(sum, _mm512_mul_round_ps(_mm512_loadu_ps(mWY[k].data() + x), r[k],
+                                                               _MM_FROUND_CUR_DIRECTION),
+                                      _MM_FROUND_CUR_DIRECTION);
+        }
+        // negative overshoot clamps to 0 before the unsigned saturating narrow
+        __m512i iv = _mm512_max_epi32(_mm512_cvtps_epi32(sum), _mm512_setzero_si512());
+        __m256i packed = _mm512_cvtusepi32_epi16(iv);
+        if (step == 1) {
+            _mm256_storeu_si256((__m256i *)(d + x), packed);
+            return;
+        }
+        alignas(32) uint16_t out[16];
+        _mm256_store_si256((__m256i *)out, packed);
+        uint16_t * p = d + (size_t)x * step;
+        for (int i = 0; i < 16; ++i, p += step) *p = out[i];
+    }
+#endif
+
+private:
+    int mCols;
+    int mTaps;                  // N of the NxN neighbourhood, the `WarpInterp' value
+    std::vector<int> mSrcX;     // leftmost source column of the neighbourhood
+    std::vector<int> mSrcY;     // top source row of the neighbourhood, relative to output row
+    std::vector<float> mWX[WARP_MAX_TAPS];  // per column weights, structure of arrays for SIMD loads (`mTaps' used)
+    std::vector<float> mWY[WARP_MAX_TAPS];
+};
+
+/// `cv::remap(BORDER_CONSTANT)' of the same model and interpolation with fixed-point maps (CV_16SC2 + interpolation
+/// table index) built once for `chunkRows' rows: the maps of a column-shift model are the same for every chunk
+/// except for the row origin, which is applied by moving the source ROI instead. only chunks whose ROI would
+/// cross the source top/bottom get float maps of their own.
+class ColumnShiftRemap {
+public:
+    explicit ColumnShiftRemap(const ColumnShift & model, WarpInterp interp = WARP_INTERP_CUBIC,
+                              int chunkRows = WARP_REMAP_CHUNK_ROWS)
+    : mModel(model), mChunkRows(chunkRows), mInterpolation(WarpOptions::CvInterpolation(interp)) {
+        if (chunkRows <= 0) throw std::invalid_argument("ColumnShiftRemap: chunk rows should be positive");
+        auto range = std::minmax_element(model.shiftY.begin(), model.shiftY.end());
+        // neighbourhood rows relative to output row, with a row of margin for 1/32 px rounding
+        int half = std::max((int)interp / 2, 1);
+        mTop = (int)floor(*range.first) - half;
+        mBottom = (int)floor(*range.second) + half + 2;
+        cv::Mat mapX, mapY;
+        BuildMaps(chunkRows, -mTop, mapX, mapY);
+        cv::convertMaps(mapX, mapY, mMap1, mMap2, CV_16SC2, interp == WARP_INTERP_NEAREST);
+    }
+
+    /// `dst' (CV_16UC1, `Cols()' wide) gets as many rows as `src'
+    void Apply(const cv::Mat & src, cv::Mat & dst) const {
+        dst.create(src.rows, mModel.Cols(), CV_16UC1);
+        for (int r0 = 0; r0 < src.rows; r0 += mChunkRows) {
+            int n = std::min(mChunkRows, src.rows - r0);
+            int s = r0 + mTop, e = r0 + n + mBottom;
+            cv::Mat out = dst.rowRange(r0, r0 + n);
+            if (s >= 0 && e <= src.rows) {
+                cv::remap(src.rowRange(s, e), out, mMap1.rowRange(0, n), mMap2.empty() ? cv::Mat() : mMap2.rowRange(0, n),
+                          mInterpolation, cv::BORDER_CONSTANT);
+                continue;
+            }
+            s = std::max(s, 0);
+            e = std::min(e, src.rows);
+            cv::Mat mapX, mapY;
+            BuildMaps(n, r0 - s, mapX, mapY);
+            cv::remap(src.rowRange(s, e), out, mapX, mapY, mInterpolation, cv::BORDER_CONSTANT);
+        }
+    }
+
+    /// chunked fixed-point remap against `ColumnShiftWarp' on the same model, for every quality tier (small chunks,
+    /// so top/bottom & interior chunks are all covered), throws if more than 0.1% pixels differ by more than 1 DN
+    /// (1/32 px bins of float & double coordinates may round differently)
+    static void SelfTest(int rows = 300, int cols = 1003) {
+        cv::Mat src = TestImage::SyntheticTexture(rows, cols, CV_16UC1, 0x510E527F, 2000, 1500, 23);
+        const double coeffX[2] = { 2.7, -0.0004 };
+        const double coeffY[3] = { -11.3, 0.0052, 1.1e-7 };
+        ColumnShift model = ColumnShift::FromPolynomial(cols, coeffX, coeffY, 4);
+        for (WarpInterp interp : { WARP_INTERP_NEAREST, WARP_INTERP_LINEAR, WARP_INTERP_CUBIC, WARP_INTERP_LANCZOS }) {
+            cv::Mat expect(rows, cols, CV_16UC1), actual;
+            ColumnShiftWarp(model, interp).Apply((const uint16_t *)src.data, src.step[0] / sizeof(uint16_t), rows, cols,
+                                                 (uint16_t *)expect.data, expect.step[0] / sizeof(uint16_t), 1, 0, rows);
+            ColumnShiftRemap(model, interp, 64).Apply(src, actual);
+            size_t diff = 0;
+            int maxDev = 0;
+            for (int y = 0; y < rows; ++y) {
+                for (int x = 0; x < cols; ++x) {
+                    int dev = abs((int)actual.at<uint16_t>(y, x) - expect.at<uint16_t>(y, x));
+                    diff += dev > 1;
+                    maxDev = std::max(maxDev, dev);
+                }
+            }
+            OLOG("ColumnShiftRemap [%s]: %s pixels compared with ColumnShiftWarp, %s off by more than 1 DN, max deviation %d DN.",
+                 WarpOptions::QualityName(interp), comma_sep(rows * cols).sep(), comma_sep(diff).sep(), maxDev);
+            if (diff * 1000 > (size_t)rows * cols) {
+                throw std::runtime_error(xs("ColumnShiftRemap [%s] deviates from ColumnShiftWarp", WarpOptions::QualityName(interp)).s);
+            }
+        }
+    }
+
+    /// throughput of both engines at every quality tier on a synthetic `rows' x `cols' band under the inter-band
+    /// model, analytic kernels at `Simd::Level()' on the shared thread pool (as alignment runs them), best of `repeat'
+    static void Benchmark(int rows, int cols, int repeat = 3) {
+        cv::Mat src = TestImage::SyntheticTexture(rows, cols, CV_16UC1, 0x510E527F, 2000, 1500, 23);
+        const double coeffX[2] = { 2.7, -0.0004 };
+        const double coeffY[3] = { -11.3, 0.0052, 1.1e-7 };
+        ColumnShift model = ColumnShift::FromPolynomial(cols, coeffX, coeffY, 4);
+
+        OLOG("Warp benchmark: %d x %d uint16, SIMD %s, %d thread(s), best of %d run(s):",
+             cols, rows, Simd::Name(Simd::Level()), ThreadPool::Shared().Size(), repeat);
+        RLOG("| quality  | analytic (s) | MPix/s  | remap (s) | MPix/s  |");
+        RLOG("-----------------------------------------------------------");
+        double mpix = (double)rows * cols / 1e6;
+        cv::Mat dst(rows, cols, CV_16UC1), remapped;
+        for (WarpInterp interp : { WARP_INTERP_NEAREST, WARP_INTERP_LINEAR, WARP_INTERP_CUBIC, WARP_INTERP_LANCZOS }) {
+            ColumnShiftWarp warp(model, interp);
+            ColumnShiftRemap remap(model, interp);
+            double tWarp = 1e30, tRemap = 1e30;
+            for (int r = 0; r < repeat; ++r) {
+                stop_watch sw;
+                int blocks = (rows + WARP_BLOCK_ROWS - 1) / WARP_BLOCK_ROWS;
+                ThreadPool::Shared().ParallelFor(blocks, [&](int b, int) {
+                    int r0 = b * WARP_BLOCK_ROWS, r1 = std::min(rows, r0 + WARP_BLOCK_ROWS);
+                    warp.Apply((const uint16_t *)src.data, src.step[0] / sizeof(uint16_t), rows, cols,
+                               dst.ptr<uint16_t>(r0), dst.step[0] / sizeof(uint16_t), 1, r0, r1);
+                });
+                tWarp = std::min(tWarp, sw.tick().ellapsed);
+                stop_watch rsw;
+                remap.Apply(src, remapped);
+                tRemap = std::min(tRemap, rsw.tick().ellapsed);
+            }
+            RLOG("| %-8s |   %8.4f   | %7.1f |  %8.4f | %7.1f |",
+                 WarpOptions::QualityName(interp), tWarp, mpix / tWarp, tRemap, mpix / tRemap);
+        }
+    }
+
+private:
+    /// float maps of `rows' output rows, source row of output row y is y + `origin' + shiftY[x]
+    void BuildMaps(int rows, double origin, cv::Mat & mapX, cv::Mat & mapY) const {
+        int cols = mModel.Cols();
+        mapX.create(rows, cols, CV_32FC1);
+        mapY.create(rows, cols, CV_32FC1);
+        for (int y = 0; y < rows; ++y) {
+            float * px = mapX.ptr<float>(y);
+            float * py = mapY.ptr<float>(y);
+            for (int x = 0; x < cols; ++x) {
+                px[x] = (float)mModel.mapX[x];
+                py[x] = (float)(y + origin + mModel.shiftY[x]);
+            }
+        }
+    }
+
+private:
+    ColumnShift mModel;
+    int mChunkRows;
+    int mInterpolation; // cv::INTER_*
+    int mTop;       // first source row of any neighbourhood, relative to output row
+    int mBottom;    // one past the last one
+    cv::Mat mMap1;  // CV_16SC2 integer source coordinates of a chunk, origin at `mTop'
+    cv::Mat mMap2;  // CV_16UC1 interpolation table indices, empty for nearest
+};
+
+END_NS
+
+#endif /* warp_h */